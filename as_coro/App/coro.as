@@ -14,13 +14,16 @@ void CatStateTest(CatState& state)
 
 void UpdateCat(CatState& state)
 {
+	// 0: 🐱 1: 😺 2: 😸 3: 😻 4: 🙀
+	state.sprite = Random(0, 3);
+
 	// 画面上のある点に向かう * 3
 	for (int i = 0; i < 3; ++i)
 	{
 		const Vec2 posStart = state.pos;
-		const Vec2 posEnd = RandomVec2(Scene::Rect().stretched(-32));
+		const Vec2 posEnd = RandomVec2(state.area.stretched(-32));
 		const double period = Random(1.0, 3.0);
-		Stopwatch time(StartImmediately::Yes);
+		Stopwatch time = SimStopwatch();
 		while (time.sF() < period)
 		{
 			const double time0_1 = Clamp(time.sF() / period, 0.0, 1.0);
@@ -31,10 +34,12 @@ void UpdateCat(CatState& state)
 
 	// 画面外へ
 	{
+		state.sprite = 4;
+
 		const Vec2 posStart = state.pos;
-		const Vec2 posEnd = Vec2(state.pos.x, state.pos.y - Scene::Height() - 64);
+		const Vec2 posEnd = Vec2(state.pos.x, state.pos.y - state.area.h - 64);
 		const double period = Random(2.0, 5.0);
-		Stopwatch time(StartImmediately::Yes);
+		Stopwatch time = SimStopwatch();
 		while (time.sF() < period)
 		{
 			const double time0_1 = Clamp(time.sF() / period, 0.0, 1.0);
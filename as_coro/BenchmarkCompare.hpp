@@ -0,0 +1,277 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+/// @brief ベンチマークの繰り返し結果をベースラインと比べる
+///
+/// 指標ごとに、ベースラインと今回の値の組を Mann-Whitney の U 検定 (正規近似、同順位補正あり) で比べ、
+/// 差の大きさは Hodges-Lehmann 推定量 (組の差の中央値) とその信頼区間で表す。
+/// p 値が有意水準を下回り、かつ信頼区間が 0 を含まない場合だけ、改善・悪化と判定する。
+namespace BenchmarkCompare
+{
+	/// @brief 指標の良い向き
+	enum class Better : uint8
+	{
+		Higher,
+
+		Lower,
+	};
+
+	/// @brief 比較する指標の定義
+	struct Metric
+	{
+		String name;
+
+		Better better = Better::Lower;
+	};
+
+	/// @brief 判定
+	enum class Verdict : uint8
+	{
+		/// @brief 有意な差は無い
+		Unchanged,
+
+		Improved,
+
+		Regressed,
+
+		/// @brief 回数が足りず判定できない
+		Insufficient,
+	};
+
+	/// @brief 1つの指標の比較結果
+	struct MetricResult
+	{
+		String name;
+
+		double baselineMedian = 0.0;
+
+		double currentMedian = 0.0;
+
+		/// @brief 今回 - ベースライン の推定値 (Hodges-Lehmann)
+		double shift = 0.0;
+
+		/// @brief shift の信頼区間
+		double shiftLow = 0.0;
+
+		double shiftHigh = 0.0;
+
+		/// @brief 両側 p 値
+		double pValue = 1.0;
+
+		Verdict verdict = Verdict::Insufficient;
+	};
+
+	inline double Median(Array<double> values)
+	{
+		if (values.isEmpty())
+		{
+			return 0.0;
+		}
+
+		std::sort(values.begin(), values.end());
+
+		const size_t n = values.size();
+
+		return ((n % 2) ? values[n / 2] : ((values[n / 2 - 1] + values[n / 2]) / 2.0));
+	}
+
+	/// @brief 標準正規分布の上側確率が p となる値
+	/// @remark 有理近似 (Abramowitz and Stegun 26.2.23)。誤差は 4.5e-4 以下
+	inline double NormalQuantileUpper(double p)
+	{
+		const double t = std::sqrt(-2.0 * std::log(p));
+		return (t - ((2.515517 + (0.802853 * t) + (0.010328 * t * t)) / (1.0 + (1.432788 * t) + (0.189269 * t * t) + (0.001308 * t * t * t))));
+	}
+
+	/// @brief Mann-Whitney の U 検定の両側 p 値 (正規近似、同順位補正あり)
+	inline double MannWhitneyPValue(const Array<double>& a, const Array<double>& b)
+	{
+		const size_t n1 = a.size();
+		const size_t n2 = b.size();
+		const size_t n = (n1 + n2);
+
+		Array<std::pair<double, uint8>> all(Arg::reserve = n);
+
+		for (const double x : a)
+		{
+			all.emplace_back(x, uint8{ 0 });
+		}
+
+		for (const double x : b)
+		{
+			all.emplace_back(x, uint8{ 1 });
+		}
+
+		std::sort(all.begin(), all.end());
+
+		// 同じ値には平均順位を付ける
+		double rankSumA = 0.0;
+		double tieTerm = 0.0;
+
+		for (size_t i = 0; i < n;)
+		{
+			size_t j = i;
+
+			while ((j < n) && (all[j].first == all[i].first))
+			{
+				++j;
+			}
+
+			const double rank = ((i + 1 + j) / 2.0);
+
+			for (size_t k = i; k < j; ++k)
+			{
+				if (all[k].second == 0)
+				{
+					rankSumA += rank;
+				}
+			}
+
+			const double t = static_cast<double>(j - i);
+			tieTerm += ((t * t * t) - t);
+
+			i = j;
+		}
+
+		const double u = (rankSumA - (n1 * (n1 + 1) / 2.0));
+		const double mean = (n1 * n2 / 2.0);
+		const double variance = ((n1 * n2 / 12.0) * ((n + 1) - (tieTerm / (static_cast<double>(n) * (n - 1)))));
+
+		if (variance <= 0.0)
+		{
+			return 1.0;
+		}
+
+		// 連続性補正
+		const double z = Max((std::abs(u - mean) - 0.5), 0.0) / std::sqrt(variance);
+
+		return std::erfc(z / std::sqrt(2.0));
+	}
+
+	/// @brief Hodges-Lehmann 推定量 (b - a の組の差の中央値) と信頼区間
+	/// @return (推定値, 下限, 上限)
+	inline std::tuple<double, double, double> HodgesLehmann(const Array<double>& a, const Array<double>& b, double confidence)
+	{
+		Array<double> differences(Arg::reserve = (a.size() * b.size()));
+
+		for (const double x : a)
+		{
+			for (const double y : b)
+			{
+				differences.push_back(y - x);
+			}
+		}
+
+		std::sort(differences.begin(), differences.end());
+
+		const double n1 = static_cast<double>(a.size());
+		const double n2 = static_cast<double>(b.size());
+		const double z = NormalQuantileUpper((1.0 - confidence) / 2.0);
+
+		// 区間の端は、差を並べたときの k 番目と (N - k + 1) 番目
+		const double k = Max(std::floor((n1 * n2 / 2.0) - (z * std::sqrt(n1 * n2 * (n1 + n2 + 1) / 12.0))), 1.0);
+		const size_t low = Min((static_cast<size_t>(k) - 1), (differences.size() - 1));
+		const size_t high = (differences.size() - 1 - low);
+
+		return{ Median(differences), differences[low], differences[high] };
+	}
+
+	/// @brief 1つの指標を比べる
+	/// @param alpha 有意水準。信頼区間は (1 - alpha)
+	inline MetricResult CompareMetric(const Metric& metric, const Array<double>& baseline, const Array<double>& current, double alpha = 0.05)
+	{
+		MetricResult result{ .name = metric.name, .baselineMedian = Median(baseline), .currentMedian = Median(current) };
+
+		// 正規近似が使えるのは各 4 回程度から
+		if ((baseline.size() < 4) || (current.size() < 4))
+		{
+			return result;
+		}
+
+		std::tie(result.shift, result.shiftLow, result.shiftHigh) = HodgesLehmann(baseline, current, (1.0 - alpha));
+		result.pValue = MannWhitneyPValue(baseline, current);
+
+		const bool significant = ((result.pValue < alpha) && ((0.0 < result.shiftLow) || (result.shiftHigh < 0.0)));
+
+		if (not significant)
+		{
+			result.verdict = Verdict::Unchanged;
+		}
+		else
+		{
+			const bool higher = (0.0 < result.shift);
+			result.verdict = ((higher == (metric.better == Better::Higher)) ? Verdict::Improved : Verdict::Regressed);
+		}
+
+		return result;
+	}
+
+	inline StringView ToString(Verdict verdict)
+	{
+		switch (verdict)
+		{
+		case Verdict::Unchanged:
+			return U"unchanged";
+		case Verdict::Improved:
+			return U"improved";
+		case Verdict::Regressed:
+			return U"REGRESSED";
+		default:
+			return U"insufficient samples";
+		}
+	}
+
+	/// @brief 指標ごとの値の列を JSON にする ({ "指標名": [値, ...], ... })
+	inline JSON ToJSON(const Array<Metric>& metrics, const Array<Array<double>>& samples)
+	{
+		JSON json;
+
+		for (size_t i = 0; i < metrics.size(); ++i)
+		{
+			for (const double value : samples[i])
+			{
+				json[metrics[i].name].push_back(value);
+			}
+		}
+
+		return json;
+	}
+
+	/// @brief ベースラインの JSON から指標の値の列を取り出す
+	inline Array<double> LoadSamples(const JSON& baseline, StringView name)
+	{
+		Array<double> values;
+
+		if (baseline.hasElement(name) && baseline[name].isArray())
+		{
+			for (const auto& value : baseline[name].arrayView())
+			{
+				values.push_back(value.get<double>());
+			}
+		}
+
+		return values;
+	}
+
+	/// @brief 比較結果を JSON にする
+	inline JSON ToJSON(const Array<MetricResult>& results)
+	{
+		JSON json;
+
+		for (const auto& result : results)
+		{
+			JSON entry;
+			entry[U"name"] = result.name;
+			entry[U"baselineMedian"] = result.baselineMedian;
+			entry[U"currentMedian"] = result.currentMedian;
+			entry[U"shift"] = result.shift;
+			entry[U"shiftLow"] = result.shiftLow;
+			entry[U"shiftHigh"] = result.shiftHigh;
+			entry[U"pValue"] = result.pValue;
+			entry[U"verdict"] = String{ ToString(result.verdict) };
+			json.push_back(entry);
+		}
+
+		return json;
+	}
+}
@@ -0,0 +1,156 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "ScriptCoroutine.hpp"
+# include "CatState.hpp"
+# include "WaitSources.hpp"
+
+namespace Scripting
+{
+	using namespace AngelScript;
+
+	namespace Binding
+	{
+		/// @brief コルーチンを一時停止する
+		inline void Yield()
+		{
+			if (asIScriptContext* ctx = asGetActiveContext();
+				ctx)
+			{
+				ctx->Suspend();
+			}
+		}
+
+		/// @brief 実行中のコルーチンのスケジューラ用の記録を返す
+		/// @return コルーチン以外 (スケジューラ外の Context) から呼ばれた場合は nullptr
+		inline CoroutineRecord* CurrentCoroutine()
+		{
+			if (asIScriptContext* ctx = asGetActiveContext();
+				ctx)
+			{
+				return static_cast<CoroutineRecord*>(ctx->GetUserData(CoroutineUserData::Record));
+			}
+
+			return nullptr;
+		}
+
+		/// @brief 実行中のコルーチンが使う時計を返す
+		/// @return スケジューラの時計。スケジューラ外から呼ばれた場合は nullptr (実時間)
+		inline ISteadyClock* CurrentClock()
+		{
+			const CoroutineRecord* record = CurrentCoroutine();
+			return (record ? record->clock : nullptr);
+		}
+
+		/// @brief コルーチンを一時停止し、指定した時間が経つまで再開しない
+		/// @param seconds 待機する時間(秒)。スケジューラの時計で計測する
+		inline void Wait(double seconds)
+		{
+			if (asIScriptContext* ctx = asGetActiveContext();
+				ctx)
+			{
+				if (CoroutineRecord* record = static_cast<CoroutineRecord*>(ctx->GetUserData(CoroutineUserData::Record)))
+				{
+					record->wakeTime = (ISteadyClock::GetMicrosec(record->clock) + static_cast<uint64>(Max(seconds, 0.0) * 1e6));
+				}
+
+				ctx->Suspend();
+			}
+		}
+
+		/// @brief コルーチンを一時停止し、指定したスレッドで続きを再開させる
+		/// @remark すでにそのスレッドで実行中の場合や、スケジューラ外から呼ばれた場合は何もしない
+		inline void SwitchTo(CoroutineExecutor executor)
+		{
+			if (asIScriptContext* ctx = asGetActiveContext();
+				ctx)
+			{
+				CoroutineRecord* record = static_cast<CoroutineRecord*>(ctx->GetUserData(CoroutineUserData::Record));
+
+				if ((record == nullptr) || (record->executor == executor))
+				{
+					return;
+				}
+
+				record->executor = executor;
+				ctx->Suspend();
+			}
+		}
+
+		/// @brief 続きをメインスレッドで実行する (描画・音声・Print などを呼ぶ前に)
+		inline void SwitchToMainThread()
+		{
+			SwitchTo(CoroutineExecutor::Main);
+		}
+
+		/// @brief 続きをワーカースレッドで実行する (メインスレッド専用の関数を呼ばない計算の前に)
+		inline void SwitchToWorker()
+		{
+			SwitchTo(CoroutineExecutor::Worker);
+		}
+
+		/// @brief WaitSet のどれかの元が起きるか、タイムアウトするまでコルーチンを一時停止する
+		///
+		/// 再開後に set.fired で起きた元の番号 (タイムアウトなら -1) を調べる。
+		/// すでに条件を満たした元があれば一時停止しない。
+		/// @param timeoutSeconds タイムアウト(秒)。スケジューラの時計で計測する。負ならタイムアウトしない
+		/// @remark 待機中は set への参照を持ち続けること (解放すると待機の元から外れ、タイムアウトまで再開しない)
+		inline void Select(WaitSet* set, double timeoutSeconds)
+		{
+			if (set == nullptr)
+			{
+				return;
+			}
+
+			asIScriptContext* ctx = asGetActiveContext();
+			CoroutineRecord* record = (ctx ? static_cast<CoroutineRecord*>(ctx->GetUserData(CoroutineUserData::Record)) : nullptr);
+
+			// スケジューラ外では待機できないので、条件を満たしているかだけを調べる
+			if (record == nullptr)
+			{
+				CoroutineRecord local;
+
+				if (not set->arm(local, UINT64_MAX))
+				{
+					set->cancel();
+				}
+			}
+			else
+			{
+				const uint64 timeoutWakeTime = ((timeoutSeconds < 0.0) ? UINT64_MAX : (ISteadyClock::GetMicrosec(record->clock) + static_cast<uint64>(timeoutSeconds * 1e6)));
+
+				if (not set->arm(*record, timeoutWakeTime))
+				{
+					ctx->Suspend();
+				}
+			}
+
+			set->release();
+		}
+
+		/// @brief スケジューラの時計で計測する、開始済みの Stopwatch を作成する
+		inline void SimStopwatch(asIScriptGeneric* gen)
+		{
+			Stopwatch stopwatch{ StartImmediately::Yes, CurrentClock() };
+			gen->SetReturnObject(&stopwatch);
+		}
+
+		inline void RegisterFunctions(asIScriptEngine* engine)
+		{
+			RegisterWaitTypes(engine);
+
+			engine->RegisterGlobalFunction("void Yield()", asFUNCTION(Yield), asCALL_CDECL);
+			engine->RegisterGlobalFunction("void Wait(double)", asFUNCTION(Wait), asCALL_CDECL);
+			engine->RegisterGlobalFunction("Stopwatch SimStopwatch()", asFUNCTION(SimStopwatch), asCALL_GENERIC);
+			engine->RegisterGlobalFunction("void SwitchToMainThread()", asFUNCTION(SwitchToMainThread), asCALL_CDECL);
+			engine->RegisterGlobalFunction("void SwitchToWorker()", asFUNCTION(SwitchToWorker), asCALL_CDECL);
+			engine->RegisterGlobalFunction("void Select(WaitSet@, double = -1)", asFUNCTION(Select), asCALL_CDECL);
+		}
+
+		/// @brief 状態型を登録する
+		/// @return 登録した型と C++ の定義の不一致。一致していれば空
+		inline Array<String> RegisterObjects(asIScriptEngine* engine)
+		{
+			return RegisterStateTypes<CatState>(engine);
+		}
+	}
+}
@@ -0,0 +1,183 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "CatState.hpp"
+# include "CoroutineScheduler.hpp"
+
+/// @brief ねこシミュレーションのパラメータ
+struct CatSimulationParams
+{
+	/// @brief ねこが出現・移動する領域
+	Rect area{ 0, 0, 800, 600 };
+
+	/// @brief コルーチンを作成する間隔(秒)
+	double spawnInterval = 0.2;
+
+	/// @brief 1回に作成するコルーチンの最小数
+	int32 spawnMin = 2;
+
+	/// @brief 1回に作成するコルーチンの最大数
+	int32 spawnMax = 5;
+
+	/// @brief 1ステップでコルーチンの再開に使える実時間(秒)。0 なら制限しない
+	/// @remark 制限すると結果が実行速度に左右される
+	double resumeBudgetSeconds = 0.0;
+};
+
+/// @brief ねこシミュレーションの統計
+struct CatSimulationStats
+{
+	/// @brief update() を呼んだ回数
+	uint64 steps = 0;
+
+	/// @brief 作成したコルーチンの数
+	uint64 spawned = 0;
+
+	/// @brief 削除したコルーチンの数
+	uint64 removed = 0;
+
+	/// @brief スケジューラに作成を断られた数
+	uint64 rejected = 0;
+
+	/// @brief 同時に存在したコルーチンの最大数
+	size_t peakAlive = 0;
+};
+
+/// @brief コルーチン以外のシミュレーションの状態
+/// @remark 巻き戻し用
+struct CatSimulationWorld
+{
+	uint64 clockNanosec = 0;
+
+	Duration spawnRemaining{ 0 };
+
+	CatSimulationStats stats;
+
+	/// @brief スクリプトの Random() が使う、現在のスレッドの乱数エンジン
+	DefaultRNG rng;
+};
+
+/// @brief ねこのコルーチンを作成・実行・削除するシミュレーション
+///
+/// 描画とは独立していて、時間はスケジューラの仮想時計で進む。
+/// 通常の実行ではフレームごとに Scene::DeltaTime() だけ、ファームでは固定のステップで進める。
+class CatSimulation
+{
+public:
+	using Scheduler = CoroutineScheduler<CatState>;
+
+	CatSimulation(const CustomScript& script, const CatSimulationParams& params)
+		: params_{ params }
+		, scheduler_{ script }
+		, timerSpawn_{ SecondsF{ params.spawnInterval }, StartImmediately::Yes, &scheduler_.clock() }
+		, catClass_{ scheduler_.scheduleClass(U"cat") }
+		, catTag_{ scheduler_.costTag(U"UpdateCat") }
+	{
+	}
+
+	/// @brief シミュレーションを進める
+	/// @param deltaSeconds 進める時間(秒)
+	void update(double deltaSeconds)
+	{
+		scheduler_.clock().advance(deltaSeconds);
+
+		if (timerSpawn_.reachedZero())
+		{
+			timerSpawn_.restart();
+
+			for (auto i : step(Random(params_.spawnMin, params_.spawnMax)))
+			{
+				if (scheduler_.spawn(U"UpdateCat", CatState{ RandomVec2(params_.area.bottom().movedBy(0, 80)), Stopwatch{ StartImmediately::Yes, &scheduler_.clock() }, 0, params_.area }, { .classId = catClass_ }, catTag_))
+				{
+					++stats_.spawned;
+				}
+				else
+				{
+					++stats_.rejected;
+				}
+			}
+		}
+
+		if (0.0 < params_.resumeBudgetSeconds)
+		{
+			scheduler_.resumeAll(SecondsF{ params_.resumeBudgetSeconds });
+		}
+		else
+		{
+			scheduler_.resumeAll();
+		}
+
+		const RectF bounds = params_.area.stretched(100);
+		stats_.removed += scheduler_.removeIf([&](const CatState& state) { return not state.pos.intersects(bounds); });
+
+		stats_.peakAlive = Max(stats_.peakAlive, scheduler_.size());
+		++stats_.steps;
+	}
+
+	/// @brief 次に何かする必要があるまでの時間(秒)
+	/// @return 再開するコルーチンがあれば 0。次のコルーチンの作成か、Wait() したコルーチンの再開までの時間
+	double idleSeconds() const
+	{
+		if (scheduler_.hasDueCoroutine())
+		{
+			return 0.0;
+		}
+
+		double seconds = Max(timerSpawn_.sF(), 0.0);
+
+		if (const auto& wakeTime = scheduler_.nextWakeTime())
+		{
+			seconds = Min(seconds, ((*wakeTime - scheduler_.clock().microsec()) / 1e6));
+		}
+
+		return seconds;
+	}
+
+	const Scheduler& scheduler() const
+	{
+		return scheduler_;
+	}
+
+	Scheduler& scheduler()
+	{
+		return scheduler_;
+	}
+
+	/// @brief コルーチン以外の状態を保存する
+	CatSimulationWorld saveWorld()
+	{
+		return CatSimulationWorld{ scheduler_.clock().nanosec(), timerSpawn_.remaining(), stats_, GetDefaultRNG() };
+	}
+
+	/// @brief コルーチン以外の状態を書き戻す
+	void restoreWorld(const CatSimulationWorld& world)
+	{
+		scheduler_.clock().set(world.clockNanosec);
+		timerSpawn_.setRemaining(world.spawnRemaining);
+		stats_ = world.stats;
+		GetDefaultRNG() = world.rng;
+	}
+
+	const CatSimulationParams& params() const
+	{
+		return params_;
+	}
+
+	const CatSimulationStats& stats() const
+	{
+		return stats_;
+	}
+
+private:
+	CatSimulationParams params_;
+
+	Scheduler scheduler_;
+
+	Timer timerSpawn_;
+
+	CatSimulationStats stats_;
+
+	/// @brief ねこのコルーチンの集計用の分類
+	uint32 catClass_;
+
+	uint32 catTag_;
+};
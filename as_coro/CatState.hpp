@@ -0,0 +1,29 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "StateBinding.hpp"
+
+struct CatState
+{
+	Vec2 pos{};
+	Stopwatch time{};
+
+	/// @brief 描画するスプライトの番号 (Main.cpp のアトラスの番号。範囲外は折り返す)
+	int32 sprite = 0;
+
+	/// @brief ねこが動き回る範囲 (CatSimulationParams::area)
+	/// @remark ファームのワーカースレッドでは Scene の関数を使えないので、スクリプトはこれを使う
+	Rect area{};
+};
+
+template <>
+struct Scripting::StateTraits<CatState>
+{
+	static constexpr std::string_view Name = "CatState";
+
+	static constexpr std::array Properties{
+		SCRIPT_STATE_PROPERTY(CatState, Vec2, pos),
+		SCRIPT_STATE_PROPERTY(CatState, Stopwatch, time),
+		SCRIPT_STATE_PROPERTY(CatState, int, sprite),
+		SCRIPT_STATE_PROPERTY(CatState, Rect, area),
+	};
+};
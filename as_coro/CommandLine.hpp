@@ -0,0 +1,46 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+namespace CommandLine
+{
+	/// @brief "key=value" 形式の引数から value を取り出す
+	/// @return key が一致しなければ none
+	inline Optional<String> GetValue(const String& arg, StringView key)
+	{
+		if (arg.starts_with(key) && (key.size() < arg.size()) && (arg[key.size()] == U'='))
+		{
+			return arg.substr(key.size() + 1);
+		}
+
+		return none;
+	}
+
+	/// @brief 引数リストから "key=value" を探して値を変換する
+	/// @return 見つからないか変換できなければ none
+	template <class Type>
+	Optional<Type> Find(const Array<String>& args, StringView key)
+	{
+		for (const auto& arg : args)
+		{
+			if (const auto value = GetValue(arg, key))
+			{
+				if constexpr (std::is_same_v<Type, String>)
+				{
+					return *value;
+				}
+				else
+				{
+					return ParseOpt<Type>(*value);
+				}
+			}
+		}
+
+		return none;
+	}
+
+	/// @brief 引数リストに key (値なし) があるか
+	inline bool Has(const Array<String>& args, StringView key)
+	{
+		return args.any([&](const String& arg) { return (arg == key); });
+	}
+}
@@ -0,0 +1,315 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+namespace s3d
+{
+	using namespace AngelScript;
+
+	/// @brief スクリプト関数をコルーチンとして実行するのに必要な Context のスタックの大きさを、バイトコードから求める
+	///
+	/// 関数ごとに、ローカル変数の領域 (バイトコードが参照する最大の変数オフセット) と、
+	/// バイトコードを先頭から順にたどったときの値スタックの最大の深さを求め、
+	/// 呼び出し先のスクリプト関数の必要量を、呼び出し時点の深さに積み上げる。
+	/// 分岐の合流を区別せずに足していくので、結果は実際より大きめになる (足りなかった場合は Context がスタックを拡張する)。
+	///
+	/// 値スタックの変化が命令だけでは決まらない命令のうち、RET (関数の終わり) は深さを変えずに読み進め、
+	/// CALL・CALLSYS・ALLOC (コンストラクタの呼び出し) は呼び出し先の関数から変化を求める。
+	/// 呼び出し先が実行時に決まる CALLBND (インポートした関数)・CALLINTF (インタフェース・仮想メソッド)・CallPtr (関数ポインタ) と、
+	/// 再帰するものは上限を決められないので none とし、そのような Context は既定の大きさで作成してスタックの拡張に任せる。
+	/// none にした理由は unboundedReason() で得られる。
+	class ContextStackSize
+	{
+	public:
+		/// @brief 求めた大きさの上限。これより大きい場合も none とする
+		static constexpr uint32 MaxBytes = (1 << 20);
+
+		ContextStackSize() = default;
+
+		/// @brief モジュールのすべての関数を調べる
+		explicit ContextStackSize(asIScriptModule* module)
+		{
+			if (module == nullptr)
+			{
+				return;
+			}
+
+			for (asUINT i = 0; i < module->GetFunctionCount(); ++i)
+			{
+				asIScriptFunction* function = module->GetFunctionByIndex(i);
+				String reason;
+				entryBytes_.emplace(function->GetId(), EntryBytes_(function, reason));
+
+				if (not reason.isEmpty())
+				{
+					unboundedReasons_.emplace(function->GetId(), std::move(reason));
+				}
+			}
+		}
+
+		/// @brief function を Prepare() する Context に必要なスタックの大きさ(バイト)
+		/// @return 上限を決められない場合と、調べていない関数の場合は none
+		Optional<uint32> entryBytes(const asIScriptFunction* function) const
+		{
+			if (function == nullptr)
+			{
+				return none;
+			}
+
+			const auto it = entryBytes_.find(function->GetId());
+			return ((it != entryBytes_.end()) ? it->second : none);
+		}
+
+		/// @brief entryBytes() が none になった理由 (最初に上限を決められなかった命令と関数)
+		/// @return 上限を決められた場合と、調べていない関数の場合は空
+		String unboundedReason(const asIScriptFunction* function) const
+		{
+			if (function == nullptr)
+			{
+				return{};
+			}
+
+			const auto it = unboundedReasons_.find(function->GetId());
+			return ((it != unboundedReasons_.end()) ? it->second : String{});
+		}
+
+	private:
+		/// @brief 値の変わる命令の asSBCInfo::stackInc
+		static constexpr int VariableStackInc = 0xFFFF;
+
+		/// @brief Context がスタック上の各関数の呼び出しごとに余分に確保する量 (DWORD)
+		static constexpr uint32 ReserveDwords = (2 * AS_PTR_SIZE);
+
+		/// @brief 調べた関数の必要量(DWORD)と、調べている途中の関数
+		struct Scan_
+		{
+			HashTable<int, Optional<uint32>> done;
+
+			HashSet<int> active;
+
+			/// @brief 最初に上限を決められなかった理由
+			String reason;
+		};
+
+		HashTable<int, Optional<uint32>> entryBytes_;
+
+		HashTable<int, String> unboundedReasons_;
+
+		static Optional<uint32> EntryBytes_(asIScriptFunction* function, String& reason)
+		{
+			asIScriptEngine* engine = function->GetModule()->GetEngine();
+
+			Scan_ scan;
+			const Optional<uint32> need = FunctionDwords_(engine, function, scan);
+
+			if (not need)
+			{
+				reason = std::move(scan.reason);
+				return none;
+			}
+
+			// Prepare() は引数と戻り値の領域も確保する
+			const uint64 bytes = ((static_cast<uint64>(ArgumentDwords_(engine, function)) + AS_PTR_SIZE + *need) * sizeof(asDWORD));
+
+			if (MaxBytes < bytes)
+			{
+				reason = U"{} bytes exceeds the limit"_fmt(bytes);
+				return none;
+			}
+
+			return static_cast<uint32>(bytes);
+		}
+
+		/// @brief 上限を決められなかった理由を (最初のものだけ) 記録する
+		static Optional<uint32> GiveUp_(Scan_& scan, const asIScriptFunction* function, StringView what)
+		{
+			if (scan.reason.isEmpty())
+			{
+				scan.reason = U"{} in {}"_fmt(what, Unicode::Widen(function->GetDeclaration()));
+			}
+
+			return none;
+		}
+
+		/// @brief function の呼び出し1回で、呼び出し先も含めてスタックに積む量(DWORD)
+		static Optional<uint32> FunctionDwords_(asIScriptEngine* engine, asIScriptFunction* function, Scan_& scan)
+		{
+			if (function->GetFuncType() != asFUNC_SCRIPT)
+			{
+				return GiveUp_(scan, function, U"not a script function");
+			}
+
+			const int id = function->GetId();
+
+			if (const auto it = scan.done.find(id); it != scan.done.end())
+			{
+				return it->second;
+			}
+
+			// 調べている途中の関数をまた呼ぶなら再帰している
+			if (not scan.active.insert(id).second)
+			{
+				return GiveUp_(scan, function, U"recursion");
+			}
+
+			const Optional<uint32> result = ScanByteCode_(engine, function, scan);
+			scan.active.erase(id);
+			scan.done.emplace(id, result);
+			return result;
+		}
+
+		static Optional<uint32> ScanByteCode_(asIScriptEngine* engine, asIScriptFunction* function, Scan_& scan)
+		{
+			asUINT length = 0;
+			asDWORD* byteCode = function->GetByteCode(&length);
+
+			if (byteCode == nullptr)
+			{
+				return GiveUp_(scan, function, U"no bytecode");
+			}
+
+			int32 variableSpace = 0;
+			int64 depth = 0;
+			int64 peak = 0;
+
+			for (asUINT pos = 0; pos < length;)
+			{
+				asDWORD* bc = (byteCode + pos);
+				const asSBCInfo& info = asBCInfo[*reinterpret_cast<const asBYTE*>(bc)];
+
+				variableSpace = Max(variableSpace, MaxVariableOffset_(bc, info.type));
+				pos += asBCTypeSize[info.type];
+
+				if (info.stackInc != VariableStackInc)
+				{
+					depth += info.stackInc;
+					peak = Max(peak, depth);
+					continue;
+				}
+
+				int calleeId = 0;
+
+				switch (info.bc)
+				{
+				case asBC_RET:
+					// 関数の終わり。分岐で途中に現れることもあるので、深さはそのままにして続きを読む
+					continue;
+
+				case asBC_CALL:
+				case asBC_CALLSYS:
+					calleeId = asBC_INTARG(bc);
+					break;
+
+				case asBC_ALLOC:
+					// オブジェクトの型のポインタの後にコンストラクタの関数 ID がある
+					calleeId = asBC_INTARG(bc + AS_PTR_SIZE);
+					break;
+
+				case asBC_CALLBND:
+				case asBC_CALLINTF:
+				case asBC_CallPtr:
+				default:
+					return GiveUp_(scan, function, Unicode::Widen(info.name));
+				}
+
+				asIScriptFunction* callee = engine->GetFunctionById(calleeId);
+
+				if (callee == nullptr)
+				{
+					return GiveUp_(scan, function, U"{} to an unknown function"_fmt(Unicode::Widen(info.name)));
+				}
+
+				// スクリプト関数のフレームは、引数を積んだ現在の深さの上に置かれる
+				// (ALLOC では、さらに作成したオブジェクトのポインタを積んでからコンストラクタを呼ぶ)
+				if (callee->GetFuncType() == asFUNC_SCRIPT)
+				{
+					const Optional<uint32> calleeDwords = FunctionDwords_(engine, callee, scan);
+
+					if (not calleeDwords)
+					{
+						return none;
+					}
+
+					peak = Max(peak, (depth + ((info.bc == asBC_ALLOC) ? AS_PTR_SIZE : 0) + *calleeDwords));
+				}
+
+				// ALLOC が積んだ変数のアドレスは、コンストラクタのオブジェクトのポインタの分として数える
+				depth -= ArgumentDwords_(engine, callee);
+			}
+
+			const int64 dwords = (Max(variableSpace, 0) + peak + ReserveDwords);
+
+			if (static_cast<int64>(MaxBytes / sizeof(asDWORD)) < dwords)
+			{
+				return GiveUp_(scan, function, U"stack over the limit");
+			}
+
+			return static_cast<uint32>(dwords);
+		}
+
+		/// @brief 変数を指すオペランドのうち、最大のオフセット (正の値がローカル変数)
+		static int32 MaxVariableOffset_(const asDWORD* bc, int type)
+		{
+			switch (type)
+			{
+			case asBCTYPE_wW_ARG:
+			case asBCTYPE_rW_ARG:
+			case asBCTYPE_rW_DW_ARG:
+			case asBCTYPE_wW_QW_ARG:
+			case asBCTYPE_wW_DW_ARG:
+			case asBCTYPE_wW_W_ARG:
+			case asBCTYPE_rW_QW_ARG:
+			case asBCTYPE_rW_W_DW_ARG:
+			case asBCTYPE_rW_DW_DW_ARG:
+				return asBC_SWORDARG0(bc);
+
+			case asBCTYPE_wW_rW_ARG:
+			case asBCTYPE_wW_rW_DW_ARG:
+			case asBCTYPE_rW_rW_ARG:
+				return Max<int32>(asBC_SWORDARG0(bc), asBC_SWORDARG1(bc));
+
+			case asBCTYPE_wW_rW_rW_ARG:
+				return Max<int32>(Max<int32>(asBC_SWORDARG0(bc), asBC_SWORDARG1(bc)), asBC_SWORDARG2(bc));
+
+			default:
+				return 0;
+			}
+		}
+
+		/// @brief 呼び出し側が function のために積む量 (オブジェクト・戻り値の格納先・引数) (DWORD)
+		static uint32 ArgumentDwords_(asIScriptEngine* engine, asIScriptFunction* function)
+		{
+			uint32 dwords = (function->GetObjectType() ? AS_PTR_SIZE : 0);
+
+			asDWORD returnFlags = 0;
+			const int returnTypeId = function->GetReturnTypeId(&returnFlags);
+
+			// 値型を値で返す関数には、戻り値の格納先のアドレスを渡す
+			if ((returnTypeId & asTYPEID_MASK_OBJECT) && (not (returnTypeId & asTYPEID_OBJHANDLE)) && (not (returnFlags & asTM_INOUTREF)))
+			{
+				if (const asITypeInfo* type = engine->GetTypeInfoById(returnTypeId);
+					type && (type->GetFlags() & asOBJ_VALUE))
+				{
+					dwords += AS_PTR_SIZE;
+				}
+			}
+
+			for (asUINT i = 0; i < function->GetParamCount(); ++i)
+			{
+				int typeId = 0;
+				asDWORD flags = 0;
+				function->GetParam(i, &typeId, &flags);
+
+				if ((flags & asTM_INOUTREF) || (typeId & (asTYPEID_MASK_OBJECT | asTYPEID_OBJHANDLE)))
+				{
+					dwords += AS_PTR_SIZE;
+				}
+				else
+				{
+					dwords += Max<uint32>(((engine->GetSizeOfPrimitiveType(typeId) + 3) / 4), 1);
+				}
+			}
+
+			return dwords;
+		}
+	};
+}
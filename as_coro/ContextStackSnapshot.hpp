@@ -0,0 +1,185 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+namespace s3d
+{
+	using namespace AngelScript;
+
+	/// @brief 中断中の Context のスタック上の変数を保存・復元する
+	///
+	/// AngelScript の公開APIでは Context を複製したり、実行位置を書き換えたりできない。
+	/// そこで、保存時と同じ位置 (各階層の関数と行) で中断している Context に限り、
+	/// スコープ内の変数の値を書き戻すことで、保存時の状態に戻す。
+	/// 値をコピーできるのはプリミティブ型と POD の値型だけで、それ以外があれば保存に失敗する。
+	class ContextStackSnapshot
+	{
+	public:
+		/// @brief 変数の値を保存する
+		/// @param ctx 中断中の Context
+		/// @return コピーできない変数があった場合 false
+		bool capture(asIScriptContext* ctx)
+		{
+			frames_.clear();
+			bytes_.clear();
+
+			if ((ctx == nullptr) || (ctx->GetState() != asEXECUTION_SUSPENDED))
+			{
+				return false;
+			}
+
+			const asUINT levels = ctx->GetCallstackSize();
+
+			for (asUINT level = 0; level < levels; ++level)
+			{
+				frames_.push_back({ ctx->GetFunction(level), ctx->GetLineNumber(level) });
+			}
+
+			return ForEachVar_(ctx, [&](void* p, size_t size)
+				{
+					const size_t offset = bytes_.size();
+					bytes_.resize(offset + size);
+					std::memcpy(bytes_.data() + offset, p, size);
+				});
+		}
+
+		/// @brief 保存した値を書き戻す
+		/// @param ctx capture() したのと同じ Context
+		/// @return 中断位置が保存時と異なり、書き戻せなかった場合 false
+		bool restore(asIScriptContext* ctx) const
+		{
+			if (not matches(ctx))
+			{
+				return false;
+			}
+
+			size_t offset = 0;
+
+			const bool ok = ForEachVar_(ctx, [&](void* p, size_t size)
+				{
+					if ((offset + size) <= bytes_.size())
+					{
+						std::memcpy(p, bytes_.data() + offset, size);
+					}
+
+					offset += size;
+				});
+
+			return (ok && (offset == bytes_.size()));
+		}
+
+		/// @brief Context が保存時と同じ位置で中断しているか
+		bool matches(asIScriptContext* ctx) const
+		{
+			if ((ctx == nullptr) || (ctx->GetState() != asEXECUTION_SUSPENDED))
+			{
+				return false;
+			}
+
+			if (ctx->GetCallstackSize() != frames_.size())
+			{
+				return false;
+			}
+
+			for (asUINT level = 0; level < frames_.size(); ++level)
+			{
+				if ((ctx->GetFunction(level) != frames_[level].function)
+					|| (ctx->GetLineNumber(level) != frames_[level].line))
+				{
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		/// @brief 保存した変数の値を順に詰めたもの
+		const Array<Byte>& bytes() const
+		{
+			return bytes_;
+		}
+
+		/// @brief 変数の値を差し替える
+		/// @remark 差分から復元した値を restore() で書き戻すのに使う
+		void setBytes(Array<Byte> bytes)
+		{
+			bytes_ = std::move(bytes);
+		}
+
+	private:
+		struct Frame
+		{
+			asIScriptFunction* function;
+
+			int line;
+		};
+
+		Array<Frame> frames_;
+
+		Array<Byte> bytes_;
+
+		/// @brief スコープ内の変数を、階層の浅い順・変数番号順に列挙する
+		/// @return コピーできない変数があった場合 false
+		template <class Fty>
+		static bool ForEachVar_(asIScriptContext* ctx, Fty f)
+		{
+			asIScriptEngine* engine = ctx->GetEngine();
+
+			const asUINT levels = ctx->GetCallstackSize();
+
+			for (asUINT level = 0; level < levels; ++level)
+			{
+				const int varCount = ctx->GetVarCount(level);
+
+				for (int var = 0; var < varCount; ++var)
+				{
+					if (not ctx->IsVarInScope(var, level))
+					{
+						continue;
+					}
+
+					const char* name = nullptr;
+					int typeId = 0;
+					ctx->GetVar(var, level, &name, &typeId);
+
+					const size_t size = VarSize_(engine, typeId);
+
+					if (size == 0)
+					{
+						return false;
+					}
+
+					if (void* p = ctx->GetAddressOfVar(var, level))
+					{
+						f(p, size);
+					}
+				}
+			}
+
+			return true;
+		}
+
+		/// @brief 値をそのままコピーできる型のサイズ
+		/// @return コピーできない型なら 0
+		static size_t VarSize_(asIScriptEngine* engine, int typeId)
+		{
+			if (typeId & asTYPEID_OBJHANDLE)
+			{
+				return 0;
+			}
+
+			if (not (typeId & asTYPEID_MASK_OBJECT))
+			{
+				return static_cast<size_t>(Max(engine->GetSizeOfPrimitiveType(typeId), 0));
+			}
+
+			const asITypeInfo* type = engine->GetTypeInfoById(typeId);
+
+			if ((type == nullptr) || (not (type->GetFlags() & asOBJ_POD)))
+			{
+				return 0;
+			}
+
+			return type->GetSize();
+		}
+	};
+}
@@ -0,0 +1,860 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "CostAttribution.hpp"
+# include "LargePages.hpp"
+# include "ScriptCoroutine.hpp"
+# include "SimulationClock.hpp"
+# include "WorkerPool.hpp"
+
+namespace s3d
+{
+	/// @brief CoroutineSchedule::classId ごとの再開の集計
+	struct ScheduleClassStats
+	{
+		String name;
+
+		/// @brief 再開した回数
+		uint64 resumed = 0;
+
+		/// @brief 予算を使い切ったため、次の resumeAll() に回した回数
+		uint64 deferred = 0;
+
+		/// @brief 期限のあるコルーチンを期限までに再開できなかった回数 (次に回した場合も含む)
+		uint64 missed = 0;
+
+		/// @brief 期限を最も大きく過ぎた時間(秒)
+		double worstLatenessSeconds = 0.0;
+
+		/// @brief 予算を指定した resumeAll() で、メインスレッドでの再開に使った時間(秒)
+		double budgetSeconds = 0.0;
+	};
+
+	/// @brief ScriptCoroutine をまとめて管理・実行するスケジューラ
+	///
+	/// スケジューラごとに仮想時計を1つ持ち、作成したコルーチンの CoroutineRecord に登録する。
+	/// スクリプト側の SimStopwatch() はこの時計で計測する。
+	///
+	/// 再開順は CoroutineSchedule で決まる (期限の早い順、次に優先度の高い順、次に待ちの長い順)。
+	/// resumeAll() に予算を渡すと、予算を使い切った時点で残りを次の呼び出しに回す。
+	/// 予算を渡した場合、再開するコルーチンが複数の分類にまたがるときは分類の間で予算を重み付きで公平に分ける。
+	/// 直近 fairShareWindow() 回の resumeAll() で使った時間を重みで割った値が最も小さい分類から、1つずつ再開する
+	/// (分類の中の順番は変えない)。大量に作成された分類があっても、ほかの分類が予算を使えなくなることはない。
+	///
+	/// 状態が変わったコルーチンは dirtyCoroutines() に集まるので、
+	/// 後段の処理は clearDirty() までの間に変わったものだけを見ればよい。
+	///
+	/// スクリプトで SwitchToWorker() したコルーチンは、メインスレッドでの再開が終わった後にワーカースレッドでまとめて再開し、
+	/// そこで SwitchToMainThread() したものは同じ resumeAll() の中でメインスレッドで続きを再開する。
+	/// ワーカースレッドで再開したコルーチンの結果は、スクリプトの Random() などがスレッドごとの状態を使うため再現性が無い。
+	///
+	/// 再開に掛かった時間・回数・命令数は、作成時に付けたタグごとにスレッド別のカウンタに足し込み、
+	/// resumeAll() の最後に合計する (lastCosts() と costs())。
+	///
+	/// コルーチン (状態を含む) は、使える場合はラージページの領域からプールで確保する。
+	/// coroutines() から得た shared_ptr はスケジューラより先に破棄すること。
+	///
+	/// @tparam State コルーチンに渡す引数の型
+	template <class State>
+	class CoroutineScheduler
+	{
+	public:
+		using Coro = ScriptCoroutine<State>;
+
+		explicit CoroutineScheduler(const CustomScript& script, size_t reserve = 256)
+			: script_{ script }, coroList_{ Arg::reserve = reserve }
+		{
+		}
+
+		// Context に時計のアドレスを渡しているのでコピー・ムーブしない
+		CoroutineScheduler(const CoroutineScheduler&) = delete;
+
+		CoroutineScheduler& operator =(const CoroutineScheduler&) = delete;
+
+		/// @brief コルーチンを作成して実行リストに追加する
+		/// @param decl 関数名
+		/// @param initialState コルーチンに渡す引数の値
+		/// @param schedule 再開順の設定
+		/// @param tag 実行コストを集計するタグ (costTag() で得る)
+		/// @return 作成したコルーチン。setAcceptSpawns(false) で作成を断っている場合は nullptr
+		Coro* spawn(StringView decl, const State& initialState, const CoroutineSchedule& schedule = {}, uint32 tag = 0)
+		{
+			if (not acceptSpawns_)
+			{
+				++rejectedSpawns_;
+				return nullptr;
+			}
+
+			auto coro = std::allocate_shared<Coro>(std::pmr::polymorphic_allocator<Coro>{ &pool_ }, script_.getCoroutine<State>(decl, initialState, ((tag < costs_.size()) ? tag : 0)));
+
+			CoroutineRecord& record = coro->getRecord();
+			record.id = nextId_++;
+			record.clock = &clock_;
+			record.schedule = schedule;
+			record.wakeNotify = &woken_;
+			ordered_ |= IsOrdered_(schedule);
+
+			coroList_.push_back(coro);
+			dirty_.push_back(coro.get());
+
+			// 作成したコルーチンは次の resumeAll() ですぐに再開する
+			nextWakeTime_ = clock_.microsec();
+
+			return coro.get();
+		}
+
+		/// @brief 再開時刻になったコルーチンを1回ずつ再開する
+		///
+		/// Wait() で待機中のコルーチンは、再開時刻になるまで飛ばす。
+		/// @param budget この呼び出しで再開に使える実時間。none なら全部再開する
+		/// @remark 予算を指定すると結果が実行速度に左右されるので、再現性が必要な場合は指定しない
+		void resumeAll(const Optional<Duration>& budget = none)
+		{
+			const uint64 now = clock_.microsec();
+
+			Optional<uint64> nextWakeTime;
+
+			++passCount_;
+
+			due_.clear();
+			prepareCosts_();
+			woken_ = false;
+
+			for (size_t i = 0; i < coroList_.size(); ++i)
+			{
+				++lastCosts_[coroList_[i]->getRecord().tag].live;
+
+				if (now < coroList_[i]->getWakeTime())
+				{
+					nextWakeTime = Min(nextWakeTime.value_or(UINT64_MAX), coroList_[i]->getWakeTime());
+					continue;
+				}
+
+				due_.push_back(i);
+			}
+
+			if (ordered_)
+			{
+				std::stable_sort(due_.begin(), due_.end(), [&](size_t a, size_t b) { return ResumesBefore_(*coroList_[a], *coroList_[b]); });
+			}
+
+			const bool fair = (budget && prepareFairShare_());
+
+			const Stopwatch passTime{ StartImmediately::Yes };
+
+			for (size_t i = 0; i < due_.size(); ++i)
+			{
+				const double passElapsed = (budget ? passTime.sF() : 0.0);
+
+				// 予算は選ぶ前に調べる (選んだ後に使い切ったと分かると、選んだものを再開も次に回しもしないことになる)
+				if (budget && (budget->count() <= passElapsed))
+				{
+					if (fair)
+					{
+						fillFairShareRemaining_(i);
+					}
+
+					// 残りは再開時刻を過ぎたままなので、次の呼び出しで最初に近い順番になる
+					for (; i < due_.size(); ++i)
+					{
+						const Coro& deferred = *coroList_[due_[i]];
+						ScheduleClassStats& deferredStats = classes_[deferred.getSchedule().classId];
+
+						++deferredStats.deferred;
+
+						if (const auto& deadline = deferred.getSchedule().deadlineSeconds)
+						{
+							++deferredStats.missed;
+							deferredStats.worstLatenessSeconds = Max(deferredStats.worstLatenessSeconds, (passElapsed - *deadline));
+						}
+
+						nextWakeTime = Min(nextWakeTime.value_or(UINT64_MAX), deferred.getWakeTime());
+					}
+
+					break;
+				}
+
+				if (fair)
+				{
+					due_[i] = pickFairShare_();
+				}
+
+				Coro& coro = *coroList_[due_[i]];
+				const CoroutineSchedule& schedule = coro.getSchedule();
+				ScheduleClassStats& stats = classes_[schedule.classId];
+
+				const double elapsed = (budget ? passElapsed : (schedule.deadlineSeconds ? passTime.sF() : 0.0));
+
+				if (schedule.deadlineSeconds && (*schedule.deadlineSeconds < elapsed))
+				{
+					++stats.missed;
+					stats.worstLatenessSeconds = Max(stats.worstLatenessSeconds, (elapsed - *schedule.deadlineSeconds));
+				}
+
+				if (coro.getRecord().executor == CoroutineExecutor::Worker)
+				{
+					workerBatch_.push_back(&coro);
+					continue;
+				}
+
+				if (budget)
+				{
+					const double before = passTime.sF();
+					resumeOnMain_(coro, nextWakeTime);
+
+					const double seconds = (passTime.sF() - before);
+					fairShare_[schedule.classId].passSeconds += seconds;
+					stats.budgetSeconds += seconds;
+				}
+				else
+				{
+					resumeOnMain_(coro, nextWakeTime);
+				}
+			}
+
+			if (budget)
+			{
+				advanceFairShareWindow_();
+			}
+
+			resumeWorkerBatch_(nextWakeTime);
+
+			mergeCosts_();
+
+			// Select() の待機が終わったコルーチンは、次の呼び出しで再開する
+			if (woken_)
+			{
+				nextWakeTime = Min(nextWakeTime.value_or(UINT64_MAX), now);
+			}
+
+			nextWakeTime_ = nextWakeTime;
+		}
+
+		/// @brief SwitchToWorker() したコルーチンを再開するワーカースレッドを設定する
+		/// @param pool nullptr ならワーカー側のコルーチンも resumeAll() を呼んだスレッドで再開する
+		void setWorkerPool(WorkerPool* pool)
+		{
+			workerPool_ = pool;
+		}
+
+		/// @brief 集計用の分類の ID を得る
+		/// @param name 分類名。初めての名前なら分類を追加する
+		/// @remark ID 0 は "default"
+		uint32 scheduleClass(StringView name)
+		{
+			for (size_t i = 0; i < classes_.size(); ++i)
+			{
+				if (classes_[i].name == name)
+				{
+					return static_cast<uint32>(i);
+				}
+			}
+
+			classes_.push_back({ .name = String{ name } });
+			fairShare_.push_back({ .window = Array<double>(fairShareWindow_, 0.0) });
+
+			return static_cast<uint32>(classes_.size() - 1);
+		}
+
+		/// @brief 予算を分類の間で分けるときの重みを設定する
+		/// @param weight 大きいほど多く分ける (既定は 1)
+		void setClassWeight(uint32 classId, double weight)
+		{
+			if (classId < fairShare_.size())
+			{
+				fairShare_[classId].weight = Max(weight, MinClassWeight);
+			}
+		}
+
+		double classWeight(uint32 classId) const
+		{
+			return ((classId < fairShare_.size()) ? fairShare_[classId].weight : 1.0);
+		}
+
+		/// @brief 分類ごとに使った時間を数える resumeAll() の回数
+		size_t fairShareWindow() const
+		{
+			return fairShareWindow_;
+		}
+
+		/// @brief 分類ごとに使った時間を数える resumeAll() の回数を設定する
+		/// @remark それまでに数えた時間は捨てる
+		void setFairShareWindow(size_t passes)
+		{
+			fairShareWindow_ = Max<size_t>(passes, 1);
+
+			for (auto& group : fairShare_)
+			{
+				group.window.assign(fairShareWindow_, 0.0);
+				group.windowSeconds = 0.0;
+			}
+
+			fairShareHead_ = 0;
+		}
+
+		/// @brief 直近 fairShareWindow() 回の resumeAll() で、分類がメインスレッドでの再開に使った時間(秒)
+		double classWindowSeconds(uint32 classId) const
+		{
+			return ((classId < fairShare_.size()) ? fairShare_[classId].windowSeconds : 0.0);
+		}
+
+		/// @brief 分類ごとの再開・期限ミスの集計
+		const Array<ScheduleClassStats>& scheduleStats() const
+		{
+			return classes_;
+		}
+
+		void resetScheduleStats()
+		{
+			for (auto& stats : classes_)
+			{
+				stats = { .name = stats.name };
+			}
+		}
+
+		/// @brief 実行コストを集計するタグの ID を得る
+		/// @param name タグ名。初めての名前ならタグを追加する
+		/// @remark ID 0 は "default"
+		uint32 costTag(StringView name)
+		{
+			for (size_t i = 0; i < costs_.size(); ++i)
+			{
+				if (costs_[i].name == name)
+				{
+					return static_cast<uint32>(i);
+				}
+			}
+
+			costs_.push_back({ .name = String{ name } });
+			lastCosts_.push_back({ .name = String{ name } });
+
+			return static_cast<uint32>(costs_.size() - 1);
+		}
+
+		/// @brief 再開中に実行した命令数も数えるか
+		/// @remark 再開のたびにカウンタを読むので、数えると再開が少し遅くなる
+		void setCountInstructions(bool enabled)
+		{
+			countInstructions_ = enabled;
+		}
+
+		/// @brief タグごとの実行コストの累計
+		/// @remark live と memoryBytes は直前の resumeAll() の時点の値
+		const Array<CoroutineCost>& costs() const
+		{
+			return costs_;
+		}
+
+		/// @brief 直前の resumeAll() でのタグごとの実行コスト
+		const Array<CoroutineCost>& lastCosts() const
+		{
+			return lastCosts_;
+		}
+
+		void resetCosts()
+		{
+			for (auto& cost : costs_)
+			{
+				cost = { .name = cost.name };
+			}
+		}
+
+		/// @brief resumeAll() を呼んだ回数
+		uint64 passCount() const
+		{
+			return passCount_;
+		}
+
+		/// @brief 描画時に getState() との間を補間する、直前の状態
+		/// @remark 直前の resumeAll() で再開しなかったコルーチン (待機中・予算で次に回したもの) は、
+		/// 前の状態が古いステップのものなので、getState() を返す (補間しない)
+		const State& interpolationBase(const Coro& coro) const
+		{
+			return ((coro.getRecord().resumedPass == passCount_) ? coro.getPreviousState() : coro.getState());
+		}
+
+		/// @brief 次にコルーチンを再開する時刻 (時計のマイクロ秒)
+		/// @return 再開するコルーチンが無ければ none。Yield() したコルーチンがあれば現在時刻以前
+		const Optional<uint64>& nextWakeTime() const
+		{
+			return nextWakeTime_;
+		}
+
+		/// @brief 今 resumeAll() を呼んだら再開するコルーチンがあるか
+		bool hasDueCoroutine() const
+		{
+			return (woken_ || (nextWakeTime_ && (*nextWakeTime_ <= clock_.microsec())));
+		}
+
+		/// @brief spawn() でコルーチンを作成するか
+		/// @remark メモリが足りなくなりそうなときに、作成を断るのに使う
+		void setAcceptSpawns(bool accept)
+		{
+			acceptSpawns_ = accept;
+		}
+
+		bool acceptsSpawns() const
+		{
+			return acceptSpawns_;
+		}
+
+		/// @brief spawn() で作成を断った回数
+		uint64 rejectedSpawns() const
+		{
+			return rejectedSpawns_;
+		}
+
+		/// @brief 作業用の配列の余分な容量を解放する
+		/// @remark 次の resumeAll() で必要な分は確保し直す
+		void trim()
+		{
+			coroList_.shrink_to_fit();
+			due_ = {};
+			dirty_.shrink_to_fit();
+			workerBatch_ = {};
+			workerWasDirty_ = {};
+			returnedToMain_ = {};
+
+			for (auto& group : fairShare_)
+			{
+				group.queue = {};
+			}
+		}
+
+		/// @brief コルーチンを確保している領域を、優先してスワップアウトするよう OS に伝える
+		/// @return 伝えた領域(バイト)
+		size_t adviseColdPages()
+		{
+			return pages_.adviseCold();
+		}
+
+		/// @brief 終了したコルーチンと、条件を満たすコルーチンを削除する
+		/// @param pred State を受け取り、削除するなら true を返す関数
+		/// @return 削除した数
+		template <class Predicate>
+		size_t removeIf(Predicate pred)
+		{
+			const size_t sizeBefore = coroList_.size();
+
+			coroList_.remove_if([&](const auto& coro) { return (not coro->runnable()) || pred(coro->getState()); });
+
+			const size_t removed = (sizeBefore - coroList_.size());
+
+			if (removed && (not dirty_.isEmpty()))
+			{
+				collectDirty_();
+			}
+
+			return removed;
+		}
+
+		const Array<std::shared_ptr<Coro>>& coroutines() const
+		{
+			return coroList_;
+		}
+
+		/// @brief 実行リストを置き換える
+		/// @remark 巻き戻し用。置き換えたコルーチンは次の resumeAll() で再開時刻を調べ直す
+		void replaceCoroutines(Array<std::shared_ptr<Coro>> coroList)
+		{
+			coroList_ = std::move(coroList);
+			nextWakeTime_ = clock_.microsec();
+			ordered_ = coroList_.any([](const auto& coro) { return IsOrdered_(coro->getSchedule()); });
+			collectDirty_();
+		}
+
+		/// @brief 最後に clearDirty() してから状態が変わったか、作成されたコルーチン
+		/// @remark 変わった順に並ぶ。削除されたコルーチンは含まない
+		const Array<Coro*>& dirtyCoroutines() const
+		{
+			return dirty_;
+		}
+
+		/// @brief 変更の記録を消す
+		void clearDirty()
+		{
+			for (Coro* coro : dirty_)
+			{
+				coro->clearDirty();
+			}
+
+			dirty_.clear();
+		}
+
+		size_t size() const
+		{
+			return coroList_.size();
+		}
+
+		/// @brief コルーチンを確保している領域
+		const LargePages::Resource& pages() const
+		{
+			return pages_;
+		}
+
+		SimulationClock& clock()
+		{
+			return clock_;
+		}
+
+		const SimulationClock& clock() const
+		{
+			return clock_;
+		}
+
+	private:
+		const CustomScript& script_;
+
+		// コルーチンより先に破棄されないように、coroList_ より前に置く
+		LargePages::Resource pages_;
+
+		std::pmr::unsynchronized_pool_resource pool_{ &pages_ };
+
+		Array<std::shared_ptr<Coro>> coroList_;
+
+		SimulationClock clock_;
+
+		Optional<uint64> nextWakeTime_;
+
+		uint64 nextId_ = 0;
+
+		uint64 passCount_ = 0;
+
+		bool acceptSpawns_ = true;
+
+		uint64 rejectedSpawns_ = 0;
+
+		Array<ScheduleClassStats> classes_{ ScheduleClassStats{ .name = U"default" } };
+
+		/// @brief 予算を分ける単位としての分類
+		struct FairShareGroup_
+		{
+			double weight = 1.0;
+
+			/// @brief 直近の resumeAll() ごとに使った時間(秒) (リングバッファ)
+			Array<double> window;
+
+			/// @brief window の合計
+			double windowSeconds = 0.0;
+
+			/// @brief この resumeAll() で使った時間(秒)
+			double passSeconds = 0.0;
+
+			/// @brief この resumeAll() で再開するコルーチンの coroList_ のインデックス (再開順)
+			Array<size_t> queue;
+
+			/// @brief queue の次に再開する位置
+			size_t next = 0;
+		};
+
+		static constexpr double MinClassWeight = 1e-3;
+
+		static constexpr size_t DefaultFairShareWindow = 60;
+
+		size_t fairShareWindow_ = DefaultFairShareWindow;
+
+		/// @brief [classId] (classes_ と同じ順)
+		Array<FairShareGroup_> fairShare_{ FairShareGroup_{ .window = Array<double>(DefaultFairShareWindow, 0.0) } };
+
+		/// @brief window の次に書く位置
+		size_t fairShareHead_ = 0;
+
+		/// @brief 期限か優先度を指定したコルーチンがあり、並べ替えが必要か
+		bool ordered_ = false;
+
+		/// @brief resumeAll() で再開するコルーチンの coroList_ のインデックス
+		Array<size_t> due_;
+
+		/// @brief 状態が変わったコルーチン
+		Array<Coro*> dirty_;
+
+		WorkerPool* workerPool_ = nullptr;
+
+		/// @brief この resumeAll() でワーカースレッドで再開するコルーチン
+		Array<Coro*> workerBatch_;
+
+		/// @brief workerBatch_ の各コルーチンが再開前に isDirty() だったか
+		Array<uint8> workerWasDirty_;
+
+		/// @brief ワーカースレッドから SwitchToMainThread() したコルーチン
+		Array<Coro*> returnedToMain_;
+
+		Array<CoroutineCost> costs_{ CoroutineCost{ .name = U"default" } };
+
+		Array<CoroutineCost> lastCosts_{ CoroutineCost{ .name = U"default" } };
+
+		/// @brief [WorkerPool::CurrentThreadIndex()][タグ] のカウンタ
+		/// @remark 各スレッドは自分の行だけに書くので、再開中は同期しない
+		Array<Array<CoroutineCostCounters>> threadCosts_;
+
+		bool countInstructions_ = false;
+
+		/// @brief Select() で待機していたコルーチンが起こされたか (CoroutineRecord::wakeNotify)
+		std::atomic<bool> woken_ = false;
+
+		/// @brief due_ を分類ごとに分ける
+		/// @return 2つ以上の分類にまたがり、分類の間で予算を分ける必要がある場合 true
+		bool prepareFairShare_()
+		{
+			for (auto& group : fairShare_)
+			{
+				group.queue.clear();
+				group.next = 0;
+				group.passSeconds = 0.0;
+			}
+
+			size_t groupCount = 0;
+
+			for (const size_t index : due_)
+			{
+				Array<size_t>& queue = fairShare_[coroList_[index]->getSchedule().classId].queue;
+				groupCount += queue.isEmpty();
+				queue.push_back(index);
+			}
+
+			return (1 < groupCount);
+		}
+
+		/// @brief 使った時間を重みで割った値が最も小さい分類から、次に再開するコルーチンを選ぶ
+		size_t pickFairShare_()
+		{
+			FairShareGroup_* best = nullptr;
+			double bestUsage = 0.0;
+
+			for (auto& group : fairShare_)
+			{
+				if (group.queue.size() <= group.next)
+				{
+					continue;
+				}
+
+				const double usage = ((group.windowSeconds + group.passSeconds) / group.weight);
+
+				if ((best == nullptr) || (usage < bestUsage))
+				{
+					best = &group;
+					bestUsage = usage;
+				}
+			}
+
+			return best->queue[best->next++];
+		}
+
+		/// @brief 予算を使い切ったとき、まだ選んでいないコルーチンを due_[i] 以降に並べる
+		/// @remark due_[0, i) は pickFairShare_() で選んだものなので、残りはちょうど due_.size() - i 個になる
+		void fillFairShareRemaining_(size_t i)
+		{
+			for (auto& group : fairShare_)
+			{
+				while (group.next < group.queue.size())
+				{
+					due_[i++] = group.queue[group.next++];
+				}
+			}
+		}
+
+		/// @brief この resumeAll() で使った時間を、分類ごとの直近の時間に加える
+		void advanceFairShareWindow_()
+		{
+			for (auto& group : fairShare_)
+			{
+				group.windowSeconds = Max((group.windowSeconds + group.passSeconds - group.window[fairShareHead_]), 0.0);
+				group.window[fairShareHead_] = group.passSeconds;
+			}
+
+			fairShareHead_ = ((fairShareHead_ + 1) % fairShareWindow_);
+		}
+
+		/// @brief resumeAll() の最初に、このパスのカウンタを空にする
+		void prepareCosts_()
+		{
+			threadCosts_.resize(workerPool_ ? (workerPool_->size() + 1) : 1);
+
+			for (auto& counters : threadCosts_)
+			{
+				counters.assign(costs_.size(), CoroutineCostCounters{});
+			}
+
+			// 名前はムーブして戻し、毎回の再開で文字列を確保し直さない
+			for (auto& cost : lastCosts_)
+			{
+				cost = { .name = std::move(cost.name) };
+			}
+		}
+
+		/// @brief スレッドごとのカウンタをタグごとに合計する
+		void mergeCosts_()
+		{
+			for (size_t tag = 0; tag < costs_.size(); ++tag)
+			{
+				CoroutineCost& last = lastCosts_[tag];
+
+				for (const auto& counters : threadCosts_)
+				{
+					last.resumed += counters[tag].resumed;
+					last.seconds += (counters[tag].nanoseconds / 1e9);
+					last.instructions += counters[tag].instructions;
+				}
+
+				last.memoryBytes = (last.live * sizeof(Coro));
+
+				CoroutineCost& total = costs_[tag];
+				total.resumed += last.resumed;
+				total.seconds += last.seconds;
+				total.instructions += last.instructions;
+				total.live = last.live;
+				total.memoryBytes = last.memoryBytes;
+			}
+		}
+
+		/// @brief 再開し、現在のスレッドのカウンタに時間と命令数を足す
+		void resumeMeasured_(Coro& coro)
+		{
+			CoroutineCostCounters& counters = threadCosts_[WorkerPool::CurrentThreadIndex()][coro.getRecord().tag];
+			InstructionCounter* instructions = (countInstructions_ ? &InstructionCounter::ForCurrentThread() : nullptr);
+
+			// Select() のタイムアウトで再開する場合は、待機の元から外す
+			CancelSelect(coro.getRecord());
+
+			coro.getRecord().resumedPass = passCount_;
+
+			const uint64 instructionsBefore = (instructions ? instructions->read() : 0);
+			const uint64 start = Time::GetNanosec();
+
+			coro();
+
+			counters.nanoseconds += (Time::GetNanosec() - start);
+			++counters.resumed;
+
+			if (instructions)
+			{
+				counters.instructions += (instructions->read() - instructionsBefore);
+			}
+		}
+
+		/// @brief 再開した後の集計と、変更・次の再開時刻の記録
+		void afterResume_(Coro& coro, bool wasDirty, Optional<uint64>& nextWakeTime)
+		{
+			++classes_[coro.getSchedule().classId].resumed;
+
+			if ((not wasDirty) && coro.isDirty())
+			{
+				dirty_.push_back(&coro);
+			}
+
+			if (coro.runnable())
+			{
+				nextWakeTime = Min(nextWakeTime.value_or(UINT64_MAX), coro.getWakeTime());
+			}
+		}
+
+		/// @brief 現在のスレッドで再開する。SwitchToWorker() したらワーカースレッドの再開に回す
+		void resumeOnMain_(Coro& coro, Optional<uint64>& nextWakeTime)
+		{
+			const bool wasDirty = coro.isDirty();
+
+			resumeMeasured_(coro);
+
+			afterResume_(coro, wasDirty, nextWakeTime);
+
+			if (coro.runnable() && (coro.getRecord().executor == CoroutineExecutor::Worker))
+			{
+				workerBatch_.push_back(&coro);
+			}
+		}
+
+		/// @brief workerBatch_ をワーカースレッドで再開し、SwitchToMainThread() したものの続きを再開する
+		void resumeWorkerBatch_(Optional<uint64>& nextWakeTime)
+		{
+			if (workerBatch_.isEmpty())
+			{
+				return;
+			}
+
+			workerWasDirty_.resize(workerBatch_.size());
+
+			for (size_t i = 0; i < workerBatch_.size(); ++i)
+			{
+				workerWasDirty_[i] = workerBatch_[i]->isDirty();
+			}
+
+			// ワーカースレッドではコルーチンの実行だけを行い、スケジューラの状態はこのスレッドで更新する
+			if (workerPool_)
+			{
+				workerPool_->parallelFor(workerBatch_.size(), [this](size_t i) { resumeMeasured_(*workerBatch_[i]); });
+			}
+			else
+			{
+				for (Coro* coro : workerBatch_)
+				{
+					resumeMeasured_(*coro);
+				}
+			}
+
+			returnedToMain_.clear();
+
+			for (size_t i = 0; i < workerBatch_.size(); ++i)
+			{
+				Coro& coro = *workerBatch_[i];
+
+				afterResume_(coro, workerWasDirty_[i], nextWakeTime);
+
+				if (coro.runnable() && (coro.getRecord().executor == CoroutineExecutor::Main))
+				{
+					returnedToMain_.push_back(&coro);
+				}
+			}
+
+			// ここで再び SwitchToWorker() したものは、resumeOnMain_() が workerBatch_ に加えるが、
+			// 次の resumeAll() で再開時刻を調べ直してワーカースレッドで再開するので、まとめて捨てる
+			for (Coro* coro : returnedToMain_)
+			{
+				resumeOnMain_(*coro, nextWakeTime);
+			}
+
+			workerBatch_.clear();
+		}
+
+		void collectDirty_()
+		{
+			dirty_.clear();
+
+			for (const auto& coro : coroList_)
+			{
+				if (coro->isDirty())
+				{
+					dirty_.push_back(coro.get());
+				}
+			}
+		}
+
+		static bool IsOrdered_(const CoroutineSchedule& schedule)
+		{
+			return (schedule.deadlineSeconds || (schedule.priority != 0));
+		}
+
+		/// @brief a を b より先に再開するか
+		static bool ResumesBefore_(const Coro& a, const Coro& b)
+		{
+			const CoroutineSchedule& sa = a.getSchedule();
+			const CoroutineSchedule& sb = b.getSchedule();
+
+			if (sa.deadlineSeconds.has_value() != sb.deadlineSeconds.has_value())
+			{
+				return sa.deadlineSeconds.has_value();
+			}
+
+			if (sa.deadlineSeconds && (*sa.deadlineSeconds != *sb.deadlineSeconds))
+			{
+				return (*sa.deadlineSeconds < *sb.deadlineSeconds);
+			}
+
+			if (sa.priority != sb.priority)
+			{
+				return (sb.priority < sa.priority);
+			}
+
+			// 先に再開時刻になったものから
+			return (a.getWakeTime() < b.getWakeTime());
+		}
+	};
+}
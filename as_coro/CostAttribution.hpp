@@ -0,0 +1,175 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <memory_resource>
+
+# if SIV3D_PLATFORM(LINUX)
+#	include <sys/ioctl.h>
+#	include <sys/syscall.h>
+#	include <linux/perf_event.h>
+#	include <unistd.h>
+# endif
+
+namespace s3d
+{
+	/// @brief タグごとのコルーチンの実行コスト
+	///
+	/// タグはコルーチンの作成時に付ける (CoroutineScheduler::costTag() で得る)。
+	struct CoroutineCost
+	{
+		String name;
+
+		/// @brief 再開した回数
+		uint64 resumed = 0;
+
+		/// @brief 再開に掛かった時間の合計(秒)。ワーカースレッドでの時間も足す
+		double seconds = 0.0;
+
+		/// @brief 再開中に実行した命令数の合計
+		/// @remark 命令数を数えない設定か、計測できない環境では 0
+		uint64 instructions = 0;
+
+		/// @brief このタグの実行リスト上のコルーチンの数
+		size_t live = 0;
+
+		/// @brief このタグのコルーチンがスケジューラのプールで使っている領域(バイト)
+		/// @remark スクリプトの Context が確保するメモリは含まない
+		size_t memoryBytes = 0;
+	};
+
+	/// @brief スレッドごとに再開のたびに足し込むカウンタ
+	/// @remark resumeAll() の最後にタグごとに合計して CoroutineCost にする
+	struct CoroutineCostCounters
+	{
+		uint64 resumed = 0;
+
+		uint64 nanoseconds = 0;
+
+		uint64 instructions = 0;
+	};
+
+	/// @brief 再開に掛かった時間の多い順に n 個を返す
+	inline Array<CoroutineCost> TopCosts(Array<CoroutineCost> costs, size_t n)
+	{
+		costs.remove_if([](const CoroutineCost& cost) { return (cost.resumed == 0); });
+		costs.stable_sort_by([](const CoroutineCost& a, const CoroutineCost& b) { return (b.seconds < a.seconds); });
+
+		if (n < costs.size())
+		{
+			costs.resize(n);
+		}
+
+		return costs;
+	}
+
+	/// @brief 再開に掛かった時間の多い順に n 個を指すポインタを out に入れる
+	/// @remark 毎フレームの表示用。out のアロケータ (FrameArena など) だけを使い、名前の文字列はコピーしない
+	inline void TopCosts(const Array<CoroutineCost>& costs, size_t n, std::pmr::vector<const CoroutineCost*>& out)
+	{
+		out.clear();
+
+		for (const auto& cost : costs)
+		{
+			if (cost.resumed != 0)
+			{
+				out.push_back(&cost);
+			}
+		}
+
+		std::stable_sort(out.begin(), out.end(), [](const CoroutineCost* a, const CoroutineCost* b) { return (b->seconds < a->seconds); });
+
+		if (n < out.size())
+		{
+			out.resize(n);
+		}
+	}
+
+	inline JSON ToJSON(const Array<CoroutineCost>& costs)
+	{
+		JSON json;
+
+		for (const auto& cost : costs)
+		{
+			JSON entry;
+			entry[U"name"] = cost.name;
+			entry[U"resumed"] = cost.resumed;
+			entry[U"seconds"] = cost.seconds;
+			entry[U"instructions"] = cost.instructions;
+			entry[U"live"] = cost.live;
+			entry[U"memoryBytes"] = cost.memoryBytes;
+			json.push_back(entry);
+		}
+
+		return json;
+	}
+
+	/// @brief 現在のスレッドで実行した命令数を数える
+	/// @remark Linux の perf_event でのみ計測できる (権限が無い場合も計測できない)
+	class InstructionCounter
+	{
+	public:
+		InstructionCounter()
+		{
+		# if SIV3D_PLATFORM(LINUX)
+
+			perf_event_attr attr{};
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.size = sizeof(attr);
+			attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			fd_ = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+
+		# endif
+		}
+
+		InstructionCounter(const InstructionCounter&) = delete;
+
+		InstructionCounter& operator =(const InstructionCounter&) = delete;
+
+		~InstructionCounter()
+		{
+		# if SIV3D_PLATFORM(LINUX)
+
+			if (fd_ != -1)
+			{
+				::close(fd_);
+			}
+
+		# endif
+		}
+
+		/// @brief 現在のスレッド用のカウンタ
+		/// @remark 最初に呼んだときに作成し、スレッドの終了時に破棄する
+		static InstructionCounter& ForCurrentThread()
+		{
+			thread_local InstructionCounter counter;
+			return counter;
+		}
+
+		/// @brief 作成してからの命令数
+		/// @return 計測できない場合 0
+		uint64 read() const
+		{
+		# if SIV3D_PLATFORM(LINUX)
+
+			uint64 count = 0;
+
+			if ((fd_ != -1) && (::read(fd_, &count, sizeof(count)) == sizeof(count)))
+			{
+				return count;
+			}
+
+		# endif
+
+			return 0;
+		}
+
+	private:
+	# if SIV3D_PLATFORM(LINUX)
+
+		int fd_ = -1;
+
+	# endif
+	};
+}
@@ -0,0 +1,172 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <span>
+# include "WorkerPool.hpp"
+
+/// @brief 多数のねこを、1匹ずつではなく低解像度の密度の分布として描く
+///
+/// 画面をセルに分け、セルごとの数を数えて1枚のテクスチャにする。
+/// 数えるのは位置の配列を分割してスレッドごとの格子に足し、最後に格子を合計する。
+/// どちらのループも分岐の無い単純な形にして、コンパイラがベクトル化できるようにしている。
+class DensityField
+{
+public:
+	/// @param sceneSize 描画する領域の大きさ
+	/// @param cellSize 1セルの大きさ(ピクセル)
+	DensityField(const Size& sceneSize, int32 cellSize)
+		: cellSize_{ Max(cellSize, 1) }
+		, gridSize_{ ((sceneSize.x + cellSize_ - 1) / cellSize_), ((sceneSize.y + cellSize_ - 1) / cellSize_) }
+		, counts_(cellCount_())
+		, image_{ gridSize_ }
+	{
+	}
+
+	/// @brief 位置を数えてテクスチャを作り直す
+	/// @param pool nullptr なら現在のスレッドだけで数える
+	void update(std::span<const Vec2> positions, WorkerPool* pool)
+	{
+		const size_t chunkCount = Max<size_t>(Min<size_t>((pool ? (pool->size() + 1) : 1), (positions.size() / MinChunkSize)), 1);
+		const size_t chunkSize = ((positions.size() + chunkCount - 1) / chunkCount);
+
+		partials_.resize(chunkCount);
+
+		const auto accumulate = [&](size_t chunk)
+			{
+				const size_t begin = Min((chunk * chunkSize), positions.size());
+				const size_t end = Min((begin + chunkSize), positions.size());
+
+				Array<uint32>& cells = partials_[chunk];
+				cells.assign((cellCount_() + 1), 0);
+				accumulate_(positions.subspan(begin, (end - begin)), cells.data());
+			};
+
+		// 行ごとにスレッドの格子を合計する
+		const auto reduce = [&](size_t row)
+			{
+				uint32* out = (counts_.data() + (row * gridSize_.x));
+				std::fill_n(out, gridSize_.x, 0);
+
+				for (const auto& cells : partials_)
+				{
+					const uint32* in = (cells.data() + (row * gridSize_.x));
+
+					for (int32 x = 0; x < gridSize_.x; ++x)
+					{
+						out[x] += in[x];
+					}
+				}
+			};
+
+		if (pool && (1 < chunkCount))
+		{
+			pool->parallelFor(chunkCount, accumulate);
+			pool->parallelFor(gridSize_.y, reduce);
+		}
+		else
+		{
+			for (size_t chunk = 0; chunk < chunkCount; ++chunk)
+			{
+				accumulate(chunk);
+			}
+
+			for (int32 row = 0; row < gridSize_.y; ++row)
+			{
+				reduce(row);
+			}
+		}
+
+		fillImage_();
+
+		if (not texture_.fill(image_))
+		{
+			texture_ = DynamicTexture{ image_ };
+		}
+	}
+
+	/// @brief 描画領域いっぱいに描く
+	void draw() const
+	{
+		texture_.scaled(cellSize_).draw();
+	}
+
+	/// @brief 最も多いセルの数
+	uint32 peak() const
+	{
+		return peak_;
+	}
+
+private:
+	/// @brief 1スレッドに任せる位置の数の下限
+	static constexpr size_t MinChunkSize = 16384;
+
+	/// @brief 一度に添字を計算する位置の数
+	static constexpr size_t Batch = 64;
+
+	int32 cellSize_;
+
+	Size gridSize_;
+
+	/// @brief スレッドごとの格子。末尾の1セルは範囲外の位置の捨て場
+	Array<Array<uint32>> partials_;
+
+	Array<uint32> counts_;
+
+	uint32 peak_ = 0;
+
+	Image image_;
+
+	DynamicTexture texture_;
+
+	size_t cellCount_() const
+	{
+		return (static_cast<size_t>(gridSize_.x) * gridSize_.y);
+	}
+
+	void accumulate_(std::span<const Vec2> positions, uint32* cells) const
+	{
+		const double scale = (1.0 / cellSize_);
+		const int32 trash = static_cast<int32>(cellCount_());
+
+		int32 indices[Batch];
+
+		for (size_t base = 0; base < positions.size(); base += Batch)
+		{
+			const size_t n = Min(Batch, (positions.size() - base));
+			const Vec2* p = (positions.data() + base);
+
+			// 添字の計算は分岐せずに行い (ベクトル化できる)、範囲外は捨て場のセルにする
+			for (size_t i = 0; i < n; ++i)
+			{
+				const int32 x = static_cast<int32>(std::floor(p[i].x * scale));
+				const int32 y = static_cast<int32>(std::floor(p[i].y * scale));
+				const bool inside = ((0 <= x) & (x < gridSize_.x) & (0 <= y) & (y < gridSize_.y));
+				indices[i] = (inside ? ((y * gridSize_.x) + x) : trash);
+			}
+
+			for (size_t i = 0; i < n; ++i)
+			{
+				++cells[indices[i]];
+			}
+		}
+	}
+
+	/// @brief 数を対数で不透明度にする (最も多いセルが不透明)
+	void fillImage_()
+	{
+		peak_ = 0;
+
+		for (const uint32 count : counts_)
+		{
+			peak_ = Max(peak_, count);
+		}
+
+		const double scale = ((0 < peak_) ? (255.0 / std::log1p(static_cast<double>(peak_))) : 0.0);
+
+		Color* pixels = image_.data();
+
+		for (size_t i = 0; i < counts_.size(); ++i)
+		{
+			pixels[i] = Color{ 255, 230, 200, static_cast<uint8>(std::log1p(static_cast<double>(counts_[i])) * scale) };
+		}
+	}
+};
@@ -0,0 +1,64 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "CatState.hpp"
+# include "CoroutineScheduler.hpp"
+
+// スケジューラの自己診断。リリースビルドには含めない
+# ifdef _DEBUG
+
+/// @brief 公平配分の確認 (デバッグビルドのみ): 複数の分類のコルーチンを、予算を使い切る resumeAll() で繰り返し再開する
+///
+/// 再開時刻を過ぎたコルーチンが、毎回分類ごとにちょうど1回ずつ、再開されるか次に回されるかを調べる。
+/// 予算は 0 (すべて次に回す) と、途中で使い切る短いものを交互に使う。
+/// @return 食い違いが無ければ true
+inline bool CheckFairShare(const CustomScript& script)
+{
+	CoroutineScheduler<CatState> scheduler{ script };
+
+	const std::array<uint32, 3> classIds{ scheduler.scheduleClass(U"light"), scheduler.scheduleClass(U"medium"), scheduler.scheduleClass(U"heavy") };
+	scheduler.setClassWeight(classIds[1], 2.0);
+	scheduler.setClassWeight(classIds[2], 4.0);
+
+	// 分類ごとに数を変え、due_ の末尾と先に選ばれる分類が食い違うようにする
+	for (size_t i = 0; i < 300; ++i)
+	{
+		const uint32 classId = classIds[(i % 6 == 0) ? 0 : ((i % 6 < 3) ? 1 : 2)];
+		scheduler.spawn(U"UpdateCat", CatState{ RandomVec2(Scene::Rect()), Stopwatch{ StartImmediately::Yes, &scheduler.clock() }, 0, Scene::Rect() }, { .classId = classId });
+	}
+
+	const std::array<double, 4> budgets{ 0.0, 20e-6, 50e-6, 200e-6 };
+
+	for (size_t pass = 0; pass < 120; ++pass)
+	{
+		scheduler.clock().advance(1.0 / 60.0);
+
+		const uint64 now = scheduler.clock().microsec();
+		Array<uint64> due(scheduler.scheduleStats().size(), 0);
+
+		for (const auto& coro : scheduler.coroutines())
+		{
+			due[coro->getSchedule().classId] += (coro->getWakeTime() <= now);
+		}
+
+		const Array<uint64> handledBefore = scheduler.scheduleStats().map([](const ScheduleClassStats& stats) { return (stats.resumed + stats.deferred); });
+
+		scheduler.resumeAll(SecondsF{ budgets[pass % budgets.size()] });
+
+		for (const uint32 classId : classIds)
+		{
+			const ScheduleClassStats& stats = scheduler.scheduleStats()[classId];
+			const uint64 handled = (stats.resumed + stats.deferred - handledBefore[classId]);
+
+			if (handled != due[classId])
+			{
+				Console << U"fair-share check: pass {}, class {}: {} due, {} resumed or deferred"_fmt(pass, stats.name, due[classId], handled);
+				return false;
+			}
+		}
+	}
+
+	Console << U"fair-share check: ok";
+	return true;
+}
+
+# endif
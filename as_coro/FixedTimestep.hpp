@@ -0,0 +1,72 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+/// @brief 描画フレームとは独立した固定レートでシミュレーションを進めるためのタイムステップ
+///
+/// フレームごとに advance() で実時間を加え、返ってきた回数だけ stepSeconds() ずつ進める。
+/// 描画では alpha() を使って直前2回の状態を補間する。
+/// rateHz が 0 以下の場合は固定レートにせず、毎フレーム1回、そのフレームの経過時間で進める。
+class FixedTimestep
+{
+public:
+	/// @param rateHz シミュレーションのレート
+	/// @param maxStepsPerFrame 1フレームで進める最大回数。処理が追いつかない場合、超えた分の時間は捨てる
+	explicit FixedTimestep(double rateHz = 60.0, size_t maxStepsPerFrame = 8)
+		: stepSeconds_{ (0.0 < rateHz) ? (1.0 / rateHz) : 0.0 }
+		, maxStepsPerFrame_{ Max<size_t>(maxStepsPerFrame, 1) }
+	{
+	}
+
+	/// @brief 実時間を加えて、このフレームで進めるステップ数を返す
+	/// @param deltaSeconds 前のフレームからの経過時間(秒)
+	size_t advance(double deltaSeconds)
+	{
+		if (not isFixed())
+		{
+			lastDelta_ = deltaSeconds;
+			return 1;
+		}
+
+		accumulator_ += deltaSeconds;
+
+		const size_t steps = static_cast<size_t>(accumulator_ / stepSeconds_);
+
+		if (maxStepsPerFrame_ < steps)
+		{
+			accumulator_ = Math::Fmod(accumulator_, stepSeconds_);
+			return maxStepsPerFrame_;
+		}
+
+		accumulator_ -= (steps * stepSeconds_);
+
+		return steps;
+	}
+
+	/// @brief 1ステップで進める時間(秒)
+	double stepSeconds() const
+	{
+		return (isFixed() ? stepSeconds_ : lastDelta_);
+	}
+
+	/// @brief 描画時の補間係数 [0, 1]
+	/// @remark 0 で1つ前の状態、1 で最新の状態
+	double alpha() const
+	{
+		return (isFixed() ? Clamp(accumulator_ / stepSeconds_, 0.0, 1.0) : 1.0);
+	}
+
+	/// @brief 固定レートで進めているか
+	bool isFixed() const
+	{
+		return (0.0 < stepSeconds_);
+	}
+
+private:
+	double stepSeconds_;
+
+	size_t maxStepsPerFrame_;
+
+	double accumulator_ = 0.0;
+
+	double lastDelta_ = 0.0;
+};
@@ -0,0 +1,134 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <memory_resource>
+
+/// @brief 1フレームの間だけ使う一時データ用のバンプアロケータ
+///
+/// std::pmr のコンテナに渡して使う。deallocate() は何もせず、reset() でまとめて O(1) で解放する。
+/// 容量が足りなかった分は上位のリソースから確保して reset() で解放し、
+/// 次のフレームからはその分だけ大きなバッファを使うので、定常状態では malloc を呼ばない。
+///
+/// 使っているのはメインループの描画用の一時データ (ねこのスプライト・密度表示の位置・コストの表示) だけ。
+/// スケジューラの作業用の配列は容量を残して使い回し、コルーチンの作成・削除はスケジューラのプールを使うので、
+/// どちらも定常状態では malloc を呼ばず、このアリーナを通す必要は無い。
+class FrameArena : public std::pmr::memory_resource
+{
+public:
+	/// @param capacity 最初に確保するバッファのサイズ(バイト)
+	explicit FrameArena(size_t capacity = (64 * 1024))
+		: buffer_(Max<size_t>(capacity, 1024))
+	{
+	}
+
+	FrameArena(const FrameArena&) = delete;
+
+	FrameArena& operator =(const FrameArena&) = delete;
+
+	~FrameArena()
+	{
+		releaseOverflow_();
+	}
+
+	/// @brief このフレームで確保したメモリをすべて解放する
+	/// @remark 確保したメモリを参照しているコンテナは、これより前に破棄しておくこと
+	void reset()
+	{
+		highWaterMark_ = Max(highWaterMark_, requested_);
+
+		if (not overflow_.isEmpty())
+		{
+			releaseOverflow_();
+
+			// 次のフレームで溢れないように、このフレームで必要だった分まで広げる
+			buffer_ = Array<Byte>(Max(highWaterMark_ + (highWaterMark_ / 2), buffer_.size() * 2));
+		}
+
+		offset_ = 0;
+		requested_ = 0;
+	}
+
+	/// @brief このフレームで確保したバイト数
+	size_t used() const
+	{
+		return requested_;
+	}
+
+	/// @brief これまでの1フレームあたりの最大使用量(バイト)
+	size_t highWaterMark() const
+	{
+		return Max(highWaterMark_, requested_);
+	}
+
+	/// @brief 現在のバッファのサイズ(バイト)
+	size_t capacity() const
+	{
+		return buffer_.size();
+	}
+
+	/// @brief バッファに収まらず上位のリソースから確保した回数
+	size_t overflowCount() const
+	{
+		return overflowCount_;
+	}
+
+private:
+	Array<Byte> buffer_;
+
+	size_t offset_ = 0;
+
+	size_t requested_ = 0;
+
+	size_t highWaterMark_ = 0;
+
+	size_t overflowCount_ = 0;
+
+	struct Overflow
+	{
+		void* p;
+
+		size_t bytes;
+
+		size_t alignment;
+	};
+
+	Array<Overflow> overflow_;
+
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		requested_ += bytes;
+
+		void* p = (buffer_.data() + offset_);
+		size_t space = (buffer_.size() - offset_);
+
+		if (std::align(alignment, bytes, p, space))
+		{
+			offset_ = ((static_cast<Byte*>(p) - buffer_.data()) + bytes);
+			return p;
+		}
+
+		++overflowCount_;
+		p = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+		overflow_.push_back({ p, bytes, alignment });
+		return p;
+	}
+
+	void do_deallocate(void*, size_t, size_t) override
+	{
+		// reset() でまとめて解放する
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return (this == &other);
+	}
+
+	void releaseOverflow_()
+	{
+		for (const auto& overflow : overflow_)
+		{
+			std::pmr::new_delete_resource()->deallocate(overflow.p, overflow.bytes, overflow.alignment);
+		}
+
+		overflow_.clear();
+	}
+};
@@ -0,0 +1,395 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include <memory_resource>
+
+# if SIV3D_PLATFORM(WINDOWS)
+#	include <Siv3D/Windows/Windows.hpp>
+# elif SIV3D_PLATFORM(LINUX)
+#	include <sys/mman.h>
+#	include <sys/ioctl.h>
+#	include <sys/syscall.h>
+#	include <linux/perf_event.h>
+#	include <unistd.h>
+# endif
+
+/// @brief ラージページ (Windows の Large Page、Linux の Huge Page) でメモリを確保する
+///
+/// 使えない環境では通常のページで確保する。
+/// Windows では SeLockMemoryPrivilege (「メモリ内のページのロック」) が必要。
+namespace LargePages
+{
+	/// @brief 確保したメモリのページの種類
+	enum class PageKind : uint8
+	{
+		/// @brief ラージページ
+		Large,
+
+		/// @brief 通常のページに、ラージページにまとめるよう OS に依頼した (Linux の Transparent Huge Pages)
+		Transparent,
+
+		/// @brief 通常のページ
+		Normal,
+	};
+
+	/// @brief 確保した領域
+	struct Region
+	{
+		void* data = nullptr;
+
+		size_t size = 0;
+
+		PageKind kind = PageKind::Normal;
+	};
+
+	/// @brief ラージページ1枚のサイズ(バイト)
+	/// @return 使えない場合 0
+	inline size_t PageSize()
+	{
+	# if SIV3D_PLATFORM(WINDOWS)
+
+		return ::GetLargePageMinimum();
+
+	# elif SIV3D_PLATFORM(LINUX)
+
+		return (2 * 1024 * 1024);
+
+	# else
+
+		return 0;
+
+	# endif
+	}
+
+# if SIV3D_PLATFORM(WINDOWS)
+
+	namespace detail
+	{
+		/// @brief プロセスのトークンで SeLockMemoryPrivilege を有効にする
+		inline bool EnableLockMemoryPrivilege()
+		{
+			HANDLE token = nullptr;
+
+			if (not ::OpenProcessToken(::GetCurrentProcess(), (TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY), &token))
+			{
+				return false;
+			}
+
+			TOKEN_PRIVILEGES privileges{};
+			privileges.PrivilegeCount = 1;
+			privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+			bool enabled = false;
+
+			if (::LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid))
+			{
+				// 権限が割り当てられていなくても成功し、ERROR_NOT_ALL_ASSIGNED になる
+				enabled = (::AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+					&& (::GetLastError() == ERROR_SUCCESS));
+			}
+
+			::CloseHandle(token);
+
+			return enabled;
+		}
+	}
+
+# endif
+
+	/// @brief 領域を確保する
+	/// @param size 確保するサイズ(バイト)。ラージページを使う場合はページサイズに切り上げる
+	/// @return 確保できなかった場合 data は nullptr
+	inline Region Allocate(size_t size)
+	{
+		const size_t pageSize = PageSize();
+
+		if (pageSize != 0)
+		{
+			size = (((size + pageSize - 1) / pageSize) * pageSize);
+		}
+
+	# if SIV3D_PLATFORM(WINDOWS)
+
+		static const bool privilegeEnabled = detail::EnableLockMemoryPrivilege();
+
+		if (privilegeEnabled && (pageSize != 0))
+		{
+			if (void* p = ::VirtualAlloc(nullptr, size, (MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES), PAGE_READWRITE))
+			{
+				return{ p, size, PageKind::Large };
+			}
+		}
+
+		return{ ::VirtualAlloc(nullptr, size, (MEM_RESERVE | MEM_COMMIT), PAGE_READWRITE), size, PageKind::Normal };
+
+	# elif SIV3D_PLATFORM(LINUX)
+
+		// 予約済みの Huge Page が無ければ失敗する
+		if (void* p = ::mmap(nullptr, size, (PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB), -1, 0);
+			p != MAP_FAILED)
+		{
+			return{ p, size, PageKind::Large };
+		}
+
+		void* p = ::mmap(nullptr, size, (PROT_READ | PROT_WRITE), (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+
+		if (p == MAP_FAILED)
+		{
+			return{};
+		}
+
+		const bool advised = (::madvise(p, size, MADV_HUGEPAGE) == 0);
+
+		return{ p, size, (advised ? PageKind::Transparent : PageKind::Normal) };
+
+	# else
+
+		return{ ::operator new(size, std::align_val_t{ 4096 }, std::nothrow), size, PageKind::Normal };
+
+	# endif
+	}
+
+	/// @brief Allocate() で確保した領域を解放する
+	inline void Free(const Region& region)
+	{
+		if (region.data == nullptr)
+		{
+			return;
+		}
+
+	# if SIV3D_PLATFORM(WINDOWS)
+
+		::VirtualFree(region.data, 0, MEM_RELEASE);
+
+	# elif SIV3D_PLATFORM(LINUX)
+
+		::munmap(region.data, region.size);
+
+	# else
+
+		::operator delete(region.data, std::align_val_t{ 4096 });
+
+	# endif
+	}
+
+	/// @brief ラージページの領域から切り出して確保する std::pmr のリソース
+	///
+	/// 領域は chunkSize ずつ確保し、破棄するまで解放しない。
+	/// 個々の deallocate() は何もしないので、std::pmr::unsynchronized_pool_resource の上位に置いて使う。
+	/// 領域を確保できなかった場合は上位のリソースから確保する。
+	class Resource : public std::pmr::memory_resource
+	{
+	public:
+		/// @param chunkSize 1回に確保する領域のサイズ(バイト)
+		explicit Resource(size_t chunkSize = (2 * 1024 * 1024), std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+			: chunkSize_{ chunkSize }
+			, upstream_{ upstream }
+		{
+		}
+
+		Resource(const Resource&) = delete;
+
+		Resource& operator =(const Resource&) = delete;
+
+		~Resource()
+		{
+			for (const auto& region : regions_)
+			{
+				Free(region);
+			}
+
+			for (const auto& fallback : fallbacks_)
+			{
+				upstream_->deallocate(fallback.p, fallback.bytes, fallback.alignment);
+			}
+		}
+
+		/// @brief 種類ごとの確保した領域の合計(バイト)
+		/// @remark 上位のリソースから確保した分は PageKind::Normal に含める
+		size_t reservedBytes(PageKind kind) const
+		{
+			size_t bytes = 0;
+
+			for (const auto& region : regions_)
+			{
+				bytes += ((region.kind == kind) ? region.size : 0);
+			}
+
+			if (kind == PageKind::Normal)
+			{
+				for (const auto& fallback : fallbacks_)
+				{
+					bytes += fallback.bytes;
+				}
+			}
+
+			return bytes;
+		}
+
+		/// @brief 確保した領域 (ラージページを除く) を、優先してスワップアウトするよう OS に伝える
+		///
+		/// 内容は捨てないので、次にアクセスしたときにページインされる。
+		/// Linux では MADV_COLD、Windows ではワーキングセットから外す (ロックしていない領域の VirtualUnlock())。
+		/// @return 伝えた領域(バイト)
+		size_t adviseCold()
+		{
+			size_t bytes = 0;
+
+			for (const auto& region : regions_)
+			{
+				if (region.kind == PageKind::Large)
+				{
+					continue;
+				}
+
+			# if SIV3D_PLATFORM(WINDOWS)
+
+				::VirtualUnlock(region.data, region.size);
+				bytes += region.size;
+
+			# elif SIV3D_PLATFORM(LINUX) && defined(MADV_COLD)
+
+				if (::madvise(region.data, region.size, MADV_COLD) == 0)
+				{
+					bytes += region.size;
+				}
+
+			# endif
+			}
+
+			return bytes;
+		}
+
+	private:
+		struct Fallback
+		{
+			void* p;
+
+			size_t bytes;
+
+			size_t alignment;
+		};
+
+		size_t chunkSize_;
+
+		std::pmr::memory_resource* upstream_;
+
+		Array<Region> regions_;
+
+		Array<Fallback> fallbacks_;
+
+		Byte* current_ = nullptr;
+
+		size_t space_ = 0;
+
+		void* do_allocate(size_t bytes, size_t alignment) override
+		{
+			void* p = current_;
+
+			if (current_ && std::align(alignment, bytes, p, space_))
+			{
+				current_ = (static_cast<Byte*>(p) + bytes);
+				space_ -= bytes;
+				return p;
+			}
+
+			const Region region = Allocate(Max(chunkSize_, (bytes + alignment)));
+
+			if (region.data == nullptr)
+			{
+				p = upstream_->allocate(bytes, alignment);
+				fallbacks_.push_back({ p, bytes, alignment });
+				return p;
+			}
+
+			regions_.push_back(region);
+
+			// 前の領域の残りは捨てる
+			p = region.data;
+			space_ = region.size;
+			std::align(alignment, bytes, p, space_);
+			current_ = (static_cast<Byte*>(p) + bytes);
+			space_ -= bytes;
+			return p;
+		}
+
+		void do_deallocate(void*, size_t, size_t) override
+		{
+			// 破棄するときにまとめて解放する
+		}
+
+		bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+		{
+			return (this == &other);
+		}
+	};
+
+	/// @brief 現在のスレッドのデータ TLB ミスの回数を数える
+	/// @remark Linux の perf_event でのみ計測できる (権限が無い場合も計測できない)
+	class TlbMissCounter
+	{
+	public:
+		TlbMissCounter()
+		{
+		# if SIV3D_PLATFORM(LINUX)
+
+			perf_event_attr attr{};
+			attr.type = PERF_TYPE_HW_CACHE;
+			attr.size = sizeof(attr);
+			attr.config = (PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			fd_ = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+
+			if (fd_ != -1)
+			{
+				::ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+				::ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+			}
+
+		# endif
+		}
+
+		TlbMissCounter(const TlbMissCounter&) = delete;
+
+		TlbMissCounter& operator =(const TlbMissCounter&) = delete;
+
+		~TlbMissCounter()
+		{
+		# if SIV3D_PLATFORM(LINUX)
+
+			if (fd_ != -1)
+			{
+				::close(fd_);
+			}
+
+		# endif
+		}
+
+		/// @brief 作成してからの TLB ミスの回数
+		/// @return 計測できない場合 none
+		Optional<uint64> read() const
+		{
+		# if SIV3D_PLATFORM(LINUX)
+
+			uint64 count = 0;
+
+			if ((fd_ != -1) && (::read(fd_, &count, sizeof(count)) == sizeof(count)))
+			{
+				return count;
+			}
+
+		# endif
+
+			return none;
+		}
+
+	private:
+	# if SIV3D_PLATFORM(LINUX)
+
+		int fd_ = -1;
+
+	# endif
+	};
+}
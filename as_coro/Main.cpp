@@ -1,217 +1,543 @@
 ﻿# include <Siv3D.hpp> // Siv3D v0.6.13
+# include "Binding.hpp"
+# include "CatSimulation.hpp"
+# include "CommandLine.hpp"
+# include "DensityField.hpp"
+# include "FairShareCheck.hpp"
+# include "FixedTimestep.hpp"
+# include "FrameArena.hpp"
+# include "MemoryGovernor.hpp"
+# include "RewindBuffer.hpp"
+# include "SimulationFarm.hpp"
+# include "SoakTest.hpp"
+# include "SpriteAtlas.hpp"
+# include "StateExport.hpp"
+# include "WorldChecksum.hpp"
+# include "WorldJournal.hpp"
+# include "StartupProfiler.hpp"
+
+/// @brief 描画するねこ1匹分
+struct CatSprite
+{
+	Vec2 pos;
+
+	double angle;
+
+	int32 sprite;
+};
 
-namespace s3d
+/// @brief ファームモード: 複数のシミュレーションをオフラインで実行してレポートを出力する
+///
+/// --farm-repeat=N のときは N 回繰り返してベンチマークの値を集め、ベースラインの保存・比較を行う。
+/// レポートは最後の1回分。
+static void RunFarm(const FarmConfig& config)
 {
-	using namespace AngelScript;
+	const auto metrics = SimulationFarm::BenchmarkMetrics();
+	Array<Array<double>> samples(metrics.size());
+
+	JSON report;
 
-	/// @brief AngelScriptのコルーチン
-	///
-	/// AngelScriptのコルーチンはサスペンド時に値を返すことができないので、
-	/// 値をやり取りするための変数(state_)のポインタをコルーチン作成時に渡す。
-	/// スクリプト内部で書き換えられた値を getState() で得ることができる。
-	/// 
-	/// @tparam State コルーチンに渡す引数の型
-	template <class State>
-	class ScriptCoroutine
+	for (size_t repetition = 0; repetition < config.repetitions; ++repetition)
 	{
-	public:
-		ScriptCoroutine(asIScriptContext* ctx = nullptr, const State& initialState = State{})
-			: ctx_{ ctx }, state_{ initialState }
+		SimulationFarm farm{ config };
+		farm.start();
+
+		while (System::Update())
 		{
-			ctx_->SetArgAddress(0, &state_);
+			PutText(U"farm: {} / {} ({} / {})"_fmt(farm.completed(), farm.instanceCount(), (repetition + 1), config.repetitions), Scene::Center());
+
+			if (farm.isDone())
+			{
+				break;
+			}
 		}
 
-		ScriptCoroutine(const ScriptCoroutine&) = delete;
+		farm.cancel();
+		farm.wait();
 
-		ScriptCoroutine(ScriptCoroutine&& sc)
-			: ScriptCoroutine{ sc.ctx_, sc.state_ }
+		if (not farm.isDone())
 		{
-			sc.ctx_ = nullptr;
+			return;
 		}
 
-		~ScriptCoroutine()
+		const auto values = farm.benchmarkValues();
+
+		for (size_t i = 0; i < metrics.size(); ++i)
 		{
-			if (ctx_ != nullptr)
+			if (values[i])
 			{
-				ctx_->Release();
+				samples[i].push_back(*values[i]);
 			}
 		}
 
-		ScriptCoroutine& operator =(const ScriptCoroutine&) = delete;
+		report = farm.makeReport();
+	}
+
+	const JSON benchmark = BenchmarkCompare::ToJSON(metrics, samples);
+	report[U"benchmark"] = benchmark;
 
-		ScriptCoroutine& operator =(ScriptCoroutine&& sc)
+	if (config.baselineSavePath && benchmark.save(*config.baselineSavePath))
+	{
+		Console << U"farm baseline: " << *config.baselineSavePath;
+	}
+
+	if (config.baselinePath)
+	{
+		const JSON baseline = JSON::Load(*config.baselinePath);
+
+		Array<BenchmarkCompare::MetricResult> results;
+
+		for (size_t i = 0; i < metrics.size(); ++i)
 		{
-			ctx_ = sc.ctx_;
-			sc.ctx_ = nullptr;
-			state_ = sc.state_;
+			const auto result = BenchmarkCompare::CompareMetric(metrics[i], BenchmarkCompare::LoadSamples(baseline, metrics[i].name), samples[i]);
+
+			Console << U"{}: {:.4g} -> {:.4g} (shift {:+.4g} [{:+.4g}, {:+.4g}], p = {:.3f}) {}"_fmt(result.name,
+				result.baselineMedian, result.currentMedian, result.shift, result.shiftLow, result.shiftHigh, result.pValue, BenchmarkCompare::ToString(result.verdict));
+
+			results.push_back(result);
 		}
 
-		/// @brief コルーチンが有効なら実行する
-		void operator ()() const
+		report[U"comparison"] = BenchmarkCompare::ToJSON(results);
+	}
+
+	if (report.save(config.reportPath))
+	{
+		Console << U"farm report: " << config.reportPath;
+	}
+}
+
+/// @brief ソークモード: シミュレーションを長時間回し続け、メモリなどが増え続けていないか調べる
+static void RunSoak(const CustomScript& script, const SoakConfig& config)
+{
+	SoakTest soak{ script, config };
+
+	while (System::Update())
+	{
+		const bool running = soak.update(SecondsF{ 0.012 });
+
+		PutText(U"soak: {:.0f} / {:.0f} s, {} coroutines"_fmt(soak.elapsedSeconds(), config.duration, soak.simulation().scheduler().size()), Scene::Center());
+
+		if (not running)
 		{
-			if (runnable())
+			break;
+		}
+	}
+
+	for (const auto& result : soak.analyze())
+	{
+		Logger << U"soak [{}]: {:+.3f}/h, t = {:.2f}{}"_fmt(result.name, result.slopePerHour, result.tValue, (result.growing ? U" GROWING" : U""));
+	}
+
+	if (soak.makeReport().save(config.reportPath))
+	{
+		Console << U"soak report: " << config.reportPath;
+	}
+}
+
+void Main()
+{
+	// 起動時の各段階の時間を計測する
+	StartupProfiler startup;
+
+	{
+		const StartupProfiler::Scope phase{ startup, U"window" };
+		Scene::SetBackground(Palette::Chocolate.lerp(Palette::Black, 0.5));
+	}
+
+	{
+		const StartupProfiler::Scope phase{ startup, U"bindings" };
+		{
+			const StartupProfiler::Scope subPhase{ startup, U"RegisterFunctions" };
+			Scripting::Binding::RegisterFunctions(Script::GetEngine());
+		}
+		{
+			const StartupProfiler::Scope subPhase{ startup, U"RegisterObjects" };
+
+			for (const auto& mismatch : Scripting::Binding::RegisterObjects(Script::GetEngine()))
 			{
-				ctx_->Execute();
+				startup.note(U"binding mismatch: " + mismatch);
 			}
 		}
+	}
+
+	const auto& args = System::GetCommandLineArgs();
+
+	// --checksum-compare=A,B で2つの記録を比べ、最初に食い違ったフレームとコルーチンを表示する
+	if (const auto paths = CommandLine::Find<String>(args, U"--checksum-compare"))
+	{
+		const auto files = paths->split(U',');
+		const auto comparison = ((files.size() == 2) ? WorldChecksum::Compare(files[0], files[1]) : WorldChecksum::Comparison{ .message = U"expected --checksum-compare=A,B" });
+		Console << U"checksum: " << comparison.message;
+		return;
+	}
+
+	if (const auto farmConfig = FarmConfig::FromCommandLine(args))
+	{
+		RunFarm(*farmConfig);
+		return;
+	}
 
-		/// @brief コルーチンが有効か
-		bool runnable() const
+	const CustomScript script = [&]
 		{
-			if (ctx_ == nullptr) return false;
+			const StartupProfiler::Scope phase{ startup, U"compile coro.as" };
+			return CustomScript{ U"coro.as" };
+		}();
 
-			const auto state = ctx_->GetState();
+	if (const auto soakConfig = SoakConfig::FromCommandLine(args))
+	{
+		RunSoak(script, *soakConfig);
+		return;
+	}
 
-			return (
-				state == asEContextState::asEXECUTION_PREPARED ||
-				state == asEContextState::asEXECUTION_SUSPENDED);
-		}
+# ifdef _DEBUG
+
+	// デバッグビルドのみ: --check-fair-share で、予算を使い切ったときの公平配分の再開・繰り延べの数を確かめる
+	if (CommandLine::Has(args, U"--check-fair-share"))
+	{
+		CheckFairShare(script);
+		return;
+	}
 
-		asIScriptContext* getContext() const
+# endif
+
+	startup.begin(U"simulation");
+
+	// ねこのコルーチンたち
+	// --sim-budget=ms で1ステップの再開に使う時間を制限する (超えた分は次のステップに回る)
+	CatSimulation simulation{ script, CatSimulationParams{
+		.area = Scene::Rect(),
+		.resumeBudgetSeconds = (CommandLine::Find<double>(args, U"--sim-budget").value_or(0.0) / 1000.0) } };
+
+	// --sim-workers=N で、スクリプトが SwitchToWorker() した部分を N 個のワーカースレッドで並列に実行する
+	// --sim-pin=cores|logical でワーカースレッドを物理コア・論理コアに固定する
+	Optional<WorkerPool> workerPool;
+
+	if (const auto workerCount = CommandLine::Find<size_t>(args, U"--sim-workers");
+		workerCount && (0 < *workerCount))
+	{
+		const auto pin = ThreadAffinity::ParsePinPolicy(CommandLine::Find<String>(args, U"--sim-pin").value_or(U"none"));
+
+		if (not pin)
 		{
-			return ctx_;
+			startup.note(U"unknown --sim-pin (expected none, cores or logical)");
 		}
 
-		State& getState()
+		workerPool.emplace(*workerCount, pin.value_or(ThreadAffinity::PinPolicy::None));
+		simulation.scheduler().setWorkerPool(&*workerPool);
+	}
+
+	// --cost-overlay=N でタグごとの実行コストの上位 N 個を表示する (--cost-instructions で命令数も数える)
+	const size_t costOverlayTags = CommandLine::Find<size_t>(args, U"--cost-overlay").value_or(0);
+	simulation.scheduler().setCountInstructions(CommandLine::Has(args, U"--cost-instructions"));
+
+	// --mem-governor で常駐メモリが cgroup の上限 (--mem-limit=MB を指定すればその値との小さい方) に近づいたら段階的に対処する
+	Optional<MemoryGovernor> memoryGovernor;
+
+	if (CommandLine::Has(args, U"--mem-governor"))
+	{
+		memoryGovernor.emplace(MemoryGovernor::Config{
+			.limitBytes = static_cast<uint64>(CommandLine::Find<double>(args, U"--mem-limit").value_or(0.0) * 1024 * 1024) });
+
+		if (not memoryGovernor->limitBytes())
 		{
-			return state_;
+			startup.note(U"no memory limit (cgroup or --mem-limit); governor disabled");
 		}
+	}
+
+	// コルーチンは描画とは独立した固定レートで進める (--sim-rate=0 で毎フレーム)
+	FixedTimestep timestep{ CommandLine::Find<double>(args, U"--sim-rate").value_or(60.0) };
 
-		const State& getState() const
+	// --rewind=N で直近 N フレームを記録し、Backspace で巻き戻して進め直す
+	Optional<RewindBuffer> rewind;
+
+	if (const auto rewindFrames = CommandLine::Find<size_t>(args, U"--rewind"))
+	{
+		rewind.emplace(*rewindFrames);
+	}
+
+	// --export=NAME で各ステップのねこの状態を共有メモリに書き出す
+	Optional<StateExport> stateExport;
+
+	if (const auto exportName = CommandLine::Find<String>(args, U"--export"))
+	{
+		stateExport.emplace(*exportName);
+
+		if (not stateExport->isOpen())
 		{
-			return state_;
+			startup.note(U"failed to open shared memory: " + *exportName);
+			stateExport.reset();
 		}
+	}
 
-	private:
-		asIScriptContext* ctx_;
-		State state_;
-	};
+	// --recover=PATH で、異常終了したときの記録から最後に書き込めたステップまで進め直す
+	// --journal=PATH で各ステップを記録する
+	Optional<WorldJournal::Recording> recovery;
 
-	/// @brief s3d::Script に getCoroutine() を追加したもの
-	class CustomScript : public Script
+	if (const auto recoverPath = CommandLine::Find<String>(args, U"--recover"))
 	{
-	public:
-		SIV3D_NODISCARD_CXX20
-		explicit CustomScript(FilePathView path, ScriptCompileOption compileOption = ScriptCompileOption::Default)
-			: Script(path, compileOption)
+		recovery = WorldJournal::Load(*recoverPath);
+
+		if (not recovery)
 		{
+			startup.note(U"failed to load journal: " + *recoverPath);
 		}
+	}
+
+	// --seed=N で乱数の種を指定する (--checksum の記録を比べるときは、両方の実行で同じ値を指定する)
+	// 指定しなければ毎回変わる。記録から進め直すときは記録した値を使う
+	const uint64 seed = (recovery ? recovery->seed : CommandLine::Find<uint64>(args, U"--seed").value_or(RandomUint64()));
+	Reseed(seed);
 
-		/// @brief コルーチンを作成する
-		/// @tparam CoroState コルーチンに渡す引数の型
-		/// @param decl 関数名
-		/// @param initialState コルーチンに渡す引数の値
-		template <class CoroState>
-		ScriptCoroutine<CoroState> getCoroutine(StringView decl, const CoroState& initialState = CoroState{}) const
+	// --checksum=PATH で各ステップのハッシュ値を記録する (--checksum-stacks でスクリプトのスタックも含める)
+	Optional<WorldChecksum::Recorder> checksum;
+
+	if (const auto checksumPath = CommandLine::Find<String>(args, U"--checksum"))
+	{
+		checksum.emplace(*checksumPath, CommandLine::Has(args, U"--checksum-stacks"), seed);
+	}
+
+	Optional<WorldJournal> journal;
+
+	if (const auto journalPath = CommandLine::Find<String>(args, U"--journal"))
+	{
+		journal.emplace(*journalPath, seed);
+
+		if (not journal->isOpen())
+		{
+			startup.note(U"failed to open journal: " + *journalPath);
+			journal.reset();
+		}
+		else if (rewind)
 		{
-			return ScriptCoroutine<CoroState>{ getCoroutineContext_(decl), initialState };
+			// 巻き戻すと記録したステップと食い違うので、同時には使わない
+			startup.note(U"--rewind is disabled while journaling");
+			rewind.reset();
 		}
+	}
+
+	if (recovery)
+	{
+		const auto result = recovery->replay(simulation, (journal ? &*journal : nullptr));
+		Logger << U"recover: frame {}, replayed {}, restored {}, diverged {}"_fmt(recovery->lastFrame, result.frames, result.restored, result.diverged);
+		recovery.reset();
+	}
+
+	startup.end();
+
+	// ねこ (CatState::sprite の番号の順)
+	const SpriteAtlas catAtlas = [&]
+		{
+			const StartupProfiler::Scope phase{ startup, U"sprite atlas" };
+
+			const Array<Image> images = [&]
+				{
+					const StartupProfiler::Scope subPhase{ startup, U"rasterize" };
+					return Array<Image>{ Image{ U"🐱"_emoji }, Image{ U"😺"_emoji }, Image{ U"😸"_emoji }, Image{ U"😻"_emoji }, Image{ U"🙀"_emoji } };
+				}();
+
+			const StartupProfiler::Scope subPhase{ startup, U"upload" };
+			return SpriteAtlas{ images };
+		}();
+
+	// --density-threshold=N でねこが N 匹を超えたら、マウスカーソルの周り (--density-focus=PX) の外は
+	// --density-cell=PX の格子の密度として描く
+	const size_t densityThreshold = CommandLine::Find<size_t>(args, U"--density-threshold").value_or(100'000);
+	const double densityFocusRadius = CommandLine::Find<double>(args, U"--density-focus").value_or(200.0);
+	DensityField density{ Scene::Size(), CommandLine::Find<int32>(args, U"--density-cell").value_or(8) };
 
-	private:
-		asIScriptContext* getCoroutineContext_(StringView decl) const
+	// 何もすることが無いときに1回で眠る最大時間。入力への反応はこの間隔まで遅れる
+	constexpr SecondsF MaxIdleSleep{ 0.1 };
+
+	// フレーム内だけで使う一時データ用
+	FrameArena frameArena;
+
+	// ねこの数の表示。数が変わったときだけ作り直す
+	size_t countTextValue = 0;
+	String countText = Format(countTextValue);
+
+	// 最初のフレームを表示するまでを計測してからレポートを出す
+	startup.begin(U"first frame");
+	bool startupReported = false;
+
+	while (System::Update())
+	{
+		if (not startupReported)
 		{
-			// https://www.angelcode.com/angelscript/sdk/docs/manual/doc_adv_coroutine.html
+			startup.end();
+			startupReported = true;
 
-			if (isEmpty())
+			Logger << startup.format();
+
+			if (const auto reportPath = CommandLine::Find<String>(args, U"--startup-report"))
 			{
-				return nullptr;
+				startup.toJSON().save(*reportPath);
 			}
+		}
 
-			asIScriptModule* mod = _getModule()->module;
+		for (auto i : step(timestep.advance(Scene::DeltaTime())))
+		{
+			simulation.update(timestep.stepSeconds());
 
-			asIScriptFunction* funcPtr = mod->GetFunctionByName(decl.narrow().c_str());
+			if (rewind)
+			{
+				rewind->record(simulation, timestep.stepSeconds());
+			}
 
-			if (funcPtr == nullptr)
+			if (checksum)
 			{
-				return nullptr;
+				checksum->record(simulation.stats().steps, simulation.scheduler());
 			}
 
-			// コルーチン用のContextを作成
-			asIScriptContext* coctx = GetEngine()->CreateContext();
-			coctx->Prepare(funcPtr);
+			if (stateExport)
+			{
+				stateExport->publish(simulation.stats().steps, simulation.scheduler().clock().seconds(), simulation.scheduler().coroutines());
+			}
 
-			return coctx;
+			if (journal)
+			{
+				journal->record(simulation, timestep.stepSeconds());
+
+				// 書き込みに失敗すると記録をやめる
+				if (not journal->isOpen())
+				{
+					Logger << U"journal: " << journal->error().value_or(U"stopped"_s);
+					journal.reset();
+				}
+			}
 		}
-	};
-}
 
-struct CatState
-{
-	Vec2 pos{};
-	Stopwatch time{};
-};
-
-namespace Scripting
-{
-	using namespace AngelScript;
-
-	namespace Binding
-	{
-		/// @brief コルーチンを一時停止する
-		static void Yield()
+		if (memoryGovernor)
 		{
-			if (asIScriptContext* ctx = asGetActiveContext();
-				ctx)
+			memoryGovernor->update(simulation.scheduler());
+
+			for (const auto& event : memoryGovernor->takeEvents())
 			{
-				ctx->Suspend();
+				Logger << U"memory [{}]: {} (resident {} / {} MiB)"_fmt(ToString(event.pressure), event.action, (event.residentBytes >> 20), (event.limitBytes >> 20));
 			}
 		}
 
-		static void RegisterFunctions(asIScriptEngine* engine)
+		if (rewind && KeyBackspace.down())
 		{
-			engine->RegisterGlobalFunction("void Yield()", asFUNCTION(Yield), asCALL_CDECL);
+			if (const auto frame = rewind->oldestFrame())
+			{
+				const auto result = rewind->resimulate(simulation, *frame);
+				Logger << U"rewind: frame {}, restored {}, lost {}"_fmt(*frame, result.restored, result.lost);
+			}
 		}
 
-		static void RegisterObjects(asIScriptEngine* engine)
+		const double alpha = timestep.alpha();
+
+		// 画面内にねこがいればアニメーションが続いている
+		bool animating = false;
 		{
-			engine->RegisterObjectType("CatState", sizeof(CatState), asOBJ_VALUE | asOBJ_POD);
-			engine->RegisterObjectProperty("CatState", "Vec2 pos", 0);
-			engine->RegisterObjectProperty("CatState", "Stopwatch time", 16);
-		}
-	}
-}
+			const bool densityMode = (densityThreshold < simulation.scheduler().size());
+			const Vec2 focus = Cursor::PosF();
 
-void Main()
-{
-	Scene::SetBackground(Palette::Chocolate.lerp(Palette::Black, 0.5));
+			std::pmr::vector<CatSprite> sprites{ &frameArena };
+			std::pmr::vector<Vec2> densityPositions{ &frameArena };
+
+			if (densityMode)
+			{
+				densityPositions.reserve(simulation.scheduler().size());
+			}
+			else
+			{
+				sprites.reserve(simulation.scheduler().size());
+			}
 
-	Scripting::Binding::RegisterFunctions(Script::GetEngine());
-	Scripting::Binding::RegisterObjects(Script::GetEngine());
+			for (const auto& coro : simulation.scheduler().coroutines())
+			{
+				const auto& state = coro->getState();
+				const Vec2 pos = simulation.scheduler().interpolationBase(*coro).pos.lerp(state.pos, alpha);
 
-	const CustomScript script{ U"coro.as" };
+				if (not pos.intersects(Scene::Rect().stretched(64)))
+				{
+					continue;
+				}
 
-	// コルーチンたち
-	using Coro = ScriptCoroutine<CatState>;
-	Array<std::shared_ptr<Coro>> coroList{ Arg::reserve = 256 };
+				if (densityMode && ((densityFocusRadius * densityFocusRadius) < pos.distanceFromSq(focus)))
+				{
+					densityPositions.push_back(pos);
+					continue;
+				}
 
-	// コルーチン作成用タイマー
-	Timer timerMakeCoro{ 0.2s, StartImmediately::Yes };
+				sprites.push_back({ pos, 10_deg * Periodic::Sine1_1(2.2s, state.time.sF()), state.sprite });
+			}
 
-	// ねこ
-	const auto cat = Texture{ U"🐱"_emoji };
+			animating = ((not sprites.empty()) || (not densityPositions.empty()));
 
-	while (System::Update())
-	{
-		if (timerMakeCoro.reachedZero())
-		{
-			timerMakeCoro.restart();
+			if (densityMode)
+			{
+				density.update(densityPositions, (workerPool ? &*workerPool : nullptr));
+				density.draw();
+			}
 
-			for (auto i : step(Random(2, 5)))
+			// すべて同じアトラスのテクスチャなので、1回の描画命令にまとまる
+			for (const auto& sprite : sprites)
 			{
-				coroList.emplace_back(std::make_shared<Coro>(script.getCoroutine<CatState>(U"UpdateCat", CatState{ RandomVec2(Scene::Rect().bottom().movedBy(0, 80)), Stopwatch{ StartImmediately::Yes } })));
+				const TextureRegion cat = catAtlas(sprite.sprite);
+				cat.scaled(0.75).rotated(sprite.angle).drawAt(sprite.pos, ColorF{ 0, 0.5 });
+				cat.scaled(0.7).rotated(sprite.angle).drawAt(sprite.pos);
 			}
 		}
 
-		for (auto& coro : coroList)
+		if (countTextValue != simulation.scheduler().size())
+		{
+			countTextValue = simulation.scheduler().size();
+			countText = Format(countTextValue);
+		}
+
+		PutText(countText, Arg::topLeft = Vec2{ 16, 16 });
+
+		if (costOverlayTags)
 		{
-			(*coro)();
+			double y = 40;
 
-			cat.scaled(0.75).rotated(10_deg * Periodic::Sine1_1(2.2s, coro->getState().time.sF())).drawAt(coro->getState().pos, ColorF{ 0, 0.5 });
-			cat.scaled(0.7).rotated(10_deg * Periodic::Sine1_1(2.2s, coro->getState().time.sF())).drawAt(coro->getState().pos);
+			std::pmr::vector<const CoroutineCost*> topCosts{ &frameArena };
+			TopCosts(simulation.scheduler().lastCosts(), costOverlayTags, topCosts);
+
+			for (const CoroutineCost* cost : topCosts)
+			{
+				PutText(U"{}: {:.3f} ms, {} resumes, {} instructions, {} live ({} KiB)"_fmt(cost->name, (cost->seconds * 1000.0), cost->resumed, cost->instructions, cost->live, (cost->memoryBytes / 1024)),
+					Arg::topLeft = Vec2{ 16, y });
+				y += 20;
+			}
+		}
+
+		// このフレームで状態が変わったコルーチンの記録はここまで
+		simulation.scheduler().clearDirty();
+
+		frameArena.reset();
+
+		// 再開するコルーチンも動いているねこも無ければ、次の期限まで眠ってフレームレートを下げる
+		if (const double idleSeconds = simulation.idleSeconds();
+			(0.0 < idleSeconds) && (not animating))
+		{
+			System::Sleep(Min(SecondsF{ idleSeconds }, MaxIdleSleep));
 		}
+	}
 
-		coroList.remove_if([](const auto& coro) { return not coro->getState().pos.intersects(Scene::Rect().stretched(100)); });
+	for (const auto& stats : simulation.scheduler().scheduleStats())
+	{
+		Logger << U"schedule [{}]: resumed {}, deferred {}, deadline missed {} (worst {:.3f} ms late), {:.3f} s in budget"_fmt(
+			stats.name, stats.resumed, stats.deferred, stats.missed, (stats.worstLatenessSeconds * 1000.0), stats.budgetSeconds);
+	}
 
-		PutText(Format(coroList.size()), Arg::topLeft = Vec2{ 16, 16 });
+	if (workerPool)
+	{
+		for (const auto& [i, worker] : Indexed(workerPool->utilization()))
+		{
+			Logger << U"worker {} (cpu {}): {:.1f}% busy, {} items"_fmt(i, (worker.cpu ? Format(*worker.cpu) : U"-"), (worker.utilization * 100.0), worker.items);
+		}
 	}
+
+	for (const auto& cost : TopCosts(simulation.scheduler().costs(), SimulationFarm::CostReportTags))
+	{
+		Logger << U"cost [{}]: {:.3f} s, {} resumes, {} instructions"_fmt(cost.name, cost.seconds, cost.resumed, cost.instructions);
+	}
+
+	const auto catStackBytes = script.coroutineStackBytes(U"UpdateCat");
+	Logger << U"context stack [UpdateCat]: {}"_fmt(catStackBytes ? U"{} bytes"_fmt(*catStackBytes) : U"default (unbounded: {})"_fmt(script.coroutineStackUnboundedReason(U"UpdateCat")));
+
+	Logger << U"frame arena: peak {} bytes / capacity {} bytes, {} overflows"_fmt(frameArena.highWaterMark(), frameArena.capacity(), frameArena.overflowCount());
 }
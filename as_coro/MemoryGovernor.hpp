@@ -0,0 +1,368 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "CoroutineScheduler.hpp"
+
+# if SIV3D_PLATFORM(WINDOWS)
+#	include <Siv3D/Windows/Windows.hpp>
+#	include <Psapi.h>
+# elif SIV3D_PLATFORM(LINUX)
+#	include <fstream>
+#	include <unistd.h>
+#	if defined(__GLIBC__)
+#		include <malloc.h>
+#	endif
+# endif
+
+/// @brief メモリの逼迫の段階 (上ほど軽い)
+enum class MemoryPressure : uint8
+{
+	Normal,
+
+	/// @brief スケジューラの作業用の配列とヒープの空きを解放する
+	Trim,
+
+	/// @brief スクリプトの GC を最後まで実行する
+	Collect,
+
+	/// @brief コルーチンの領域を優先してスワップアウトさせる
+	PageOut,
+
+	/// @brief コルーチンの作成を断る
+	RejectSpawns,
+};
+
+inline StringView ToString(MemoryPressure pressure)
+{
+	switch (pressure)
+	{
+	case MemoryPressure::Trim:
+		return U"trim";
+	case MemoryPressure::Collect:
+		return U"collect";
+	case MemoryPressure::PageOut:
+		return U"page-out";
+	case MemoryPressure::RejectSpawns:
+		return U"reject-spawns";
+	default:
+		return U"normal";
+	}
+}
+
+/// @brief MemoryGovernor が行った対処1つ分
+struct MemoryGovernorEvent
+{
+	/// @brief MemoryGovernor を作成してからの時間(秒)
+	double seconds = 0.0;
+
+	/// @brief 対処した後の段階
+	MemoryPressure pressure = MemoryPressure::Normal;
+
+	/// @brief 対処の内容
+	String action;
+
+	/// @brief 対処する前の常駐メモリ(バイト)
+	uint64 residentBytes = 0;
+
+	uint64 limitBytes = 0;
+};
+
+/// @brief 常駐メモリが上限に近づいたら、段階的にメモリを減らし、最後はコルーチンの作成を断る
+///
+/// 上限は、cgroup のメモリの上限 (コンテナの上限) と、設定した上限の小さい方。
+/// 常駐メモリが上限に対して各段階のしきい値を超えると、その段階までの対処を順に1回ずつ行い、
+/// 同じ段階に留まっている間は repeatSeconds ごとに、その段階の対処 (作成を断る段階では PageOut まで) を繰り返す。
+/// しきい値から hysteresis を引いた値を下回ると、調べるごとに1段階ずつ戻り (戻るたびに対処として記録する)、作成を断る段階から戻るときに作成を再開する。
+/// 行った対処は、すべて takeEvents() で得られる。
+class MemoryGovernor
+{
+public:
+	struct Config
+	{
+		/// @brief 上限(バイト)。0 なら cgroup の上限だけを使う
+		uint64 limitBytes = 0;
+
+		/// @brief 各段階 (Trim, Collect, PageOut, RejectSpawns) に入る、上限に対する常駐メモリの割合
+		std::array<double, 4> thresholds{ 0.70, 0.80, 0.90, 0.95 };
+
+		/// @brief 段階を戻すときに、しきい値から引く割合
+		double hysteresis = 0.05;
+
+		/// @brief 常駐メモリを調べる間隔(秒)
+		double intervalSeconds = 0.5;
+
+		/// @brief 同じ段階の対処を繰り返す間隔(秒)
+		double repeatSeconds = 5.0;
+
+		/// @brief 再開時刻までこれ以上あるコルーチンを休止中とみなす(秒)
+		double dormantSeconds = 1.0;
+	};
+
+	explicit MemoryGovernor(const Config& config)
+		: config_{ config }
+	{
+		const Optional<uint64> cgroupLimit = CgroupLimitBytes();
+
+		if (config_.limitBytes && cgroupLimit)
+		{
+			limitBytes_ = Min(config_.limitBytes, *cgroupLimit);
+		}
+		else if (config_.limitBytes)
+		{
+			limitBytes_ = config_.limitBytes;
+		}
+		else
+		{
+			limitBytes_ = cgroupLimit;
+		}
+	}
+
+	/// @brief 上限(バイト)
+	/// @return 設定も cgroup の上限も無ければ none (何もしない)
+	const Optional<uint64>& limitBytes() const
+	{
+		return limitBytes_;
+	}
+
+	MemoryPressure pressure() const
+	{
+		return pressure_;
+	}
+
+	/// @brief 常駐メモリを調べ、必要なら対処する
+	/// @remark 毎フレーム呼んでよい (intervalSeconds ごとにだけ調べる)
+	template <class State>
+	void update(CoroutineScheduler<State>& scheduler)
+	{
+		if ((not limitBytes_) || (sinceCheck_.sF() < config_.intervalSeconds))
+		{
+			return;
+		}
+
+		sinceCheck_.restart();
+
+		const uint64 residentBytes = ResidentBytes();
+
+		if (residentBytes == 0)
+		{
+			return;
+		}
+
+		const double ratio = (static_cast<double>(residentBytes) / static_cast<double>(*limitBytes_));
+
+		if (pressure_ < targetPressure_(ratio))
+		{
+			do
+			{
+				pressure_ = static_cast<MemoryPressure>(FromEnum(pressure_) + 1);
+				act_(pressure_, scheduler, residentBytes);
+			}
+			while (pressure_ < targetPressure_(ratio));
+
+			return;
+		}
+
+		// 対処の効果が常駐メモリに表れるまで間があるので、一度に下の段階まで戻らない
+		if ((pressure_ != MemoryPressure::Normal) && (ratio < (threshold_(pressure_) - config_.hysteresis)))
+		{
+			const MemoryPressure previous = pressure_;
+
+			if (pressure_ == MemoryPressure::RejectSpawns)
+			{
+				scheduler.setAcceptSpawns(true);
+			}
+
+			pressure_ = static_cast<MemoryPressure>(FromEnum(pressure_) - 1);
+			addEvent_(U"pressure eased from {}"_fmt(ToString(previous)), residentBytes);
+			return;
+		}
+
+		if ((pressure_ != MemoryPressure::Normal) && (config_.repeatSeconds <= sinceAction_.sF()))
+		{
+			act_(Min(pressure_, MemoryPressure::PageOut), scheduler, residentBytes);
+		}
+	}
+
+	/// @brief 前回呼んでから行った対処
+	Array<MemoryGovernorEvent> takeEvents()
+	{
+		return std::exchange(events_, {});
+	}
+
+	/// @brief プロセスの常駐メモリ(バイト)
+	/// @return 取得できなければ 0
+	static uint64 ResidentBytes()
+	{
+	# if SIV3D_PLATFORM(WINDOWS)
+
+		PROCESS_MEMORY_COUNTERS counters{};
+
+		if (::K32GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof(counters)))
+		{
+			return counters.WorkingSetSize;
+		}
+
+		return 0;
+
+	# elif SIV3D_PLATFORM(LINUX)
+
+		// /proc/self/statm: 仮想メモリ 常駐 ... (ページ単位)
+		std::ifstream ifs{ "/proc/self/statm" };
+		uint64 size = 0, resident = 0;
+
+		if (ifs >> size >> resident)
+		{
+			return (resident * static_cast<uint64>(::sysconf(_SC_PAGESIZE)));
+		}
+
+		return 0;
+
+	# else
+
+		return 0;
+
+	# endif
+	}
+
+	/// @brief このプロセスの cgroup のメモリの上限(バイト)
+	/// @return 上限が無いか、取得できなければ none
+	/// @remark コンテナ内では /sys/fs/cgroup がコンテナの cgroup を指す前提で、v2 の memory.max、v1 の memory.limit_in_bytes の順に読む
+	static Optional<uint64> CgroupLimitBytes()
+	{
+	# if SIV3D_PLATFORM(LINUX)
+
+		for (const char* path : { "/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes" })
+		{
+			std::ifstream ifs{ path };
+			std::string value;
+
+			if (not (ifs >> value))
+			{
+				continue;
+			}
+
+			// v2 は "max"、v1 はページ境界に丸めた int64 の最大値で上限なしを表す
+			if ((value == "max") || (value.find_first_not_of("0123456789") != std::string::npos))
+			{
+				return none;
+			}
+
+			const uint64 bytes = std::stoull(value);
+			return ((bytes < (uint64{ 1 } << 60)) ? Optional<uint64>{ bytes } : none);
+		}
+
+	# endif
+
+		return none;
+	}
+
+private:
+	Config config_;
+
+	Optional<uint64> limitBytes_;
+
+	MemoryPressure pressure_ = MemoryPressure::Normal;
+
+	Stopwatch stopwatch_{ StartImmediately::Yes };
+
+	Stopwatch sinceCheck_{ StartImmediately::Yes };
+
+	/// @brief 最後に対処してからの時間
+	Stopwatch sinceAction_{ StartImmediately::Yes };
+
+	Array<MemoryGovernorEvent> events_;
+
+	double threshold_(MemoryPressure pressure) const
+	{
+		return config_.thresholds[FromEnum(pressure) - 1];
+	}
+
+	MemoryPressure targetPressure_(double ratio) const
+	{
+		MemoryPressure target = MemoryPressure::Normal;
+
+		for (size_t i = 0; i < config_.thresholds.size(); ++i)
+		{
+			if (config_.thresholds[i] <= ratio)
+			{
+				target = static_cast<MemoryPressure>(i + 1);
+			}
+		}
+
+		return target;
+	}
+
+	template <class State>
+	void act_(MemoryPressure pressure, CoroutineScheduler<State>& scheduler, uint64 residentBytes)
+	{
+		sinceAction_.restart();
+
+		switch (pressure)
+		{
+		case MemoryPressure::Trim:
+			{
+				scheduler.trim();
+				TrimHeap_();
+
+				const uint64 after = ResidentBytes();
+				addEvent_(U"trimmed pools, released {} KiB"_fmt((residentBytes - Min(after, residentBytes)) / 1024), residentBytes);
+				break;
+			}
+
+		case MemoryPressure::Collect:
+			{
+				asIScriptEngine* engine = Script::GetEngine();
+				asUINT before = 0, after = 0, currentSize = 0;
+				engine->GetGCStatistics(&currentSize, &before);
+				engine->GarbageCollect(asGC_FULL_CYCLE);
+				engine->GetGCStatistics(&currentSize, &after);
+
+				addEvent_(U"full GC, destroyed {} objects"_fmt(after - before), residentBytes);
+				break;
+			}
+
+		case MemoryPressure::PageOut:
+			{
+				// コルーチンは1つの領域に混在しているので、休止中のものだけを選んでは出せない
+				const uint64 dormantTime = (scheduler.clock().microsec() + static_cast<uint64>(config_.dormantSeconds * 1e6));
+				const size_t dormant = scheduler.coroutines().count_if([&](const auto& coro) { return (dormantTime <= coro->getWakeTime()); });
+				const size_t bytes = scheduler.adviseColdPages();
+
+				addEvent_(U"paged out coroutine pool ({} KiB, {} dormant of {})"_fmt((bytes / 1024), dormant, scheduler.size()), residentBytes);
+				break;
+			}
+
+		case MemoryPressure::RejectSpawns:
+			scheduler.setAcceptSpawns(false);
+			addEvent_(U"rejecting spawns"_s, residentBytes);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	void addEvent_(String action, uint64 residentBytes)
+	{
+		events_.push_back({
+			.seconds = stopwatch_.sF(),
+			.pressure = pressure_,
+			.action = std::move(action),
+			.residentBytes = residentBytes,
+			.limitBytes = limitBytes_.value_or(0),
+		});
+	}
+
+	/// @brief ヒープの空き領域を OS に返す
+	static void TrimHeap_()
+	{
+	# if SIV3D_PLATFORM(LINUX) && defined(__GLIBC__)
+
+		::malloc_trim(0);
+
+	# elif SIV3D_PLATFORM(WINDOWS)
+
+		::HeapCompact(::GetProcessHeap(), 0);
+
+	# endif
+	}
+};
@@ -0,0 +1,419 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "CatSimulation.hpp"
+# include "ContextStackSnapshot.hpp"
+
+/// @brief ねこシミュレーションの巻き戻しバッファ
+///
+/// フレームごとに、コルーチンの状態・再開時刻・スタック上の変数と、
+/// 時計・作成タイマー・乱数エンジンを記録する。
+/// コルーチンのデータは keyframeInterval フレームごとに全体を、その間は前のフレームとの差分だけを保存する。
+/// 記録に残っているコルーチンは、スケジューラから削除された後も巻き戻しのために保持する。
+///
+/// スタックは ContextStackSnapshot で書き戻すので、記録したときと中断位置が変わったコルーチンは復元できない。
+/// 復元できなかったコルーチンは restore() の結果の lost に数え、実行リストから外す。
+class RewindBuffer
+{
+public:
+	using Coro = CatSimulation::Scheduler::Coro;
+
+	static_assert(std::is_trivially_copyable_v<CatState>);
+
+	/// @brief restore() の結果
+	struct RestoreResult
+	{
+		/// @brief 指定したフレームが記録に残っていたか
+		bool ok = false;
+
+		/// @brief 復元できたコルーチンの数
+		size_t restored = 0;
+
+		/// @brief 復元できなかったコルーチンの数
+		size_t lost = 0;
+	};
+
+	/// @param capacity 保持する最大フレーム数
+	/// @param keyframeInterval 差分ではなく全体を保存する間隔(フレーム)
+	/// @remark 古いキーフレームを捨てるとその差分も使えなくなるので、遡れるのは最低 (capacity - keyframeInterval + 1) フレーム
+	explicit RewindBuffer(size_t capacity = 16, size_t keyframeInterval = 4)
+		: capacity_{ Max<size_t>(capacity, 1) }
+		, keyframeInterval_{ Clamp<size_t>(keyframeInterval, 1, capacity_) }
+	{
+	}
+
+	/// @brief 現在のフレームを記録する
+	/// @param simulation 記録するシミュレーション
+	/// @param deltaSeconds このフレームに進めるのに update() に渡した時間
+	void record(CatSimulation& simulation, double deltaSeconds)
+	{
+		const bool keyframe = (ring_.empty() || forceKeyframe_ || (keyframeInterval_ <= framesSinceKeyframe_));
+
+		Checkpoint checkpoint{ .frame = simulation.stats().steps, .deltaSeconds = deltaSeconds, .keyframe = keyframe, .world = simulation.saveWorld() };
+
+		Array<FullData> full(Arg::reserve = simulation.scheduler().size());
+
+		size_t baseIndex = 0;
+
+		for (const auto& coro : simulation.scheduler().coroutines())
+		{
+			CoroRecord rec{ .coro = coro };
+			rec.restorable = rec.stack.capture(coro->getContext());
+
+			Array<Byte> bytes = MakeBytes_(*coro, rec.stack);
+			rec.stack.setBytes({});
+
+			// 実行リストは順序を保ったまま削除・末尾に追加されるので、前のフレームと先頭から突き合わせる
+			const Array<Byte>* base = nullptr;
+
+			if (not keyframe)
+			{
+				while ((baseIndex < lastFull_.size()) && (lastFull_[baseIndex].coro != coro.get()))
+				{
+					++baseIndex;
+				}
+
+				if ((baseIndex < lastFull_.size()) && (lastFull_[baseIndex].bytes.size() == bytes.size()))
+				{
+					base = &lastFull_[baseIndex].bytes;
+				}
+			}
+
+			if (base)
+			{
+				EncodeDelta_(*base, bytes, rec);
+			}
+			else
+			{
+				rec.data = bytes;
+			}
+
+			full.push_back({ coro.get(), std::move(bytes) });
+			checkpoint.coros.push_back(std::move(rec));
+		}
+
+		lastFull_ = std::move(full);
+		framesSinceKeyframe_ = (keyframe ? 1 : (framesSinceKeyframe_ + 1));
+		forceKeyframe_ = false;
+
+		ring_.push_back(std::move(checkpoint));
+
+		while (capacity_ < ring_.size())
+		{
+			ring_.pop_front();
+
+			// キーフレームの無い差分は復元できない
+			while ((not ring_.empty()) && (not ring_.front().keyframe))
+			{
+				ring_.pop_front();
+			}
+		}
+	}
+
+	/// @brief 記録したフレームまで巻き戻す
+	/// @param simulation record() したシミュレーション
+	/// @param frame 巻き戻すフレーム (CatSimulationStats::steps)
+	/// @remark 巻き戻したフレームより後の記録は捨てる
+	RestoreResult restore(CatSimulation& simulation, uint64 frame)
+	{
+		const auto it = std::find_if(ring_.begin(), ring_.end(), [&](const Checkpoint& checkpoint) { return (checkpoint.frame == frame); });
+
+		if (it == ring_.end())
+		{
+			return RestoreResult{};
+		}
+
+		const size_t index = static_cast<size_t>(it - ring_.begin());
+		const Array<FullData> full = materialize_(index);
+		const Checkpoint& checkpoint = ring_[index];
+
+		RestoreResult result{ .ok = true };
+
+		Array<std::shared_ptr<Coro>> coroList(Arg::reserve = checkpoint.coros.size());
+
+		for (size_t i = 0; i < checkpoint.coros.size(); ++i)
+		{
+			const CoroRecord& rec = checkpoint.coros[i];
+
+			if (rec.restorable && RestoreCoro_(*rec.coro, rec.stack, full[i].bytes))
+			{
+				coroList.push_back(rec.coro);
+				++result.restored;
+			}
+			else
+			{
+				++result.lost;
+			}
+		}
+
+		simulation.scheduler().replaceCoroutines(std::move(coroList));
+		simulation.restoreWorld(checkpoint.world);
+
+		ring_.erase((it + 1), ring_.end());
+		forceKeyframe_ = true;
+
+		return result;
+	}
+
+	/// @brief 記録したフレームまで巻き戻し、記録した時間で現在のフレームまで進め直す
+	/// @param simulation record() したシミュレーション
+	/// @param frame 巻き戻すフレーム
+	/// @param correct 各フレームで進める時間を補正する関数 (フレーム, 記録した時間) -> 時間。空なら記録した時間のまま
+	RestoreResult resimulate(CatSimulation& simulation, uint64 frame, const std::function<double(uint64, double)>& correct = {})
+	{
+		Array<std::pair<uint64, double>> inputs;
+
+		for (const auto& checkpoint : ring_)
+		{
+			if (frame < checkpoint.frame)
+			{
+				inputs.emplace_back(checkpoint.frame, checkpoint.deltaSeconds);
+			}
+		}
+
+		const RestoreResult result = restore(simulation, frame);
+
+		if (not result.ok)
+		{
+			return result;
+		}
+
+		for (const auto& [inputFrame, recordedSeconds] : inputs)
+		{
+			const double deltaSeconds = (correct ? correct(inputFrame, recordedSeconds) : recordedSeconds);
+			simulation.update(deltaSeconds);
+			record(simulation, deltaSeconds);
+		}
+
+		return result;
+	}
+
+	/// @brief 巻き戻せる最も古いフレーム
+	Optional<uint64> oldestFrame() const
+	{
+		return (ring_.empty() ? none : Optional<uint64>{ ring_.front().frame });
+	}
+
+	/// @brief 最後に記録したフレーム
+	Optional<uint64> newestFrame() const
+	{
+		return (ring_.empty() ? none : Optional<uint64>{ ring_.back().frame });
+	}
+
+	/// @brief 記録しているフレーム数
+	size_t size() const
+	{
+		return ring_.size();
+	}
+
+	/// @brief 記録に使っているおおよそのメモリ量(バイト)
+	size_t byteSize() const
+	{
+		size_t bytes = 0;
+
+		for (const auto& checkpoint : ring_)
+		{
+			bytes += sizeof(Checkpoint);
+
+			for (const auto& rec : checkpoint.coros)
+			{
+				bytes += (sizeof(CoroRecord) + rec.data.size() + (rec.runs.size() * sizeof(Run)));
+			}
+		}
+
+		return bytes;
+	}
+
+	void clear()
+	{
+		ring_.clear();
+		lastFull_.clear();
+		framesSinceKeyframe_ = 0;
+	}
+
+private:
+	/// @brief 差分の1区間
+	struct Run
+	{
+		uint32 offset;
+
+		uint32 size;
+	};
+
+	struct CoroRecord
+	{
+		std::shared_ptr<Coro> coro;
+
+		/// @brief 中断位置 (変数の値は data に入れる)
+		ContextStackSnapshot stack;
+
+		bool restorable = false;
+
+		/// @brief true なら data は runs の区間の値だけを詰めたもの
+		bool isDelta = false;
+
+		Array<Run> runs;
+
+		/// @brief 状態・再開時刻・変数の値を詰めたもの、またはその差分
+		Array<Byte> data;
+	};
+
+	struct Checkpoint
+	{
+		uint64 frame = 0;
+
+		double deltaSeconds = 0.0;
+
+		bool keyframe = false;
+
+		CatSimulationWorld world;
+
+		Array<CoroRecord> coros;
+	};
+
+	struct FullData
+	{
+		const Coro* coro;
+
+		Array<Byte> bytes;
+	};
+
+	/// @brief 差分を取る単位(バイト)
+	static constexpr size_t DeltaBlockSize = 8;
+
+	size_t capacity_;
+
+	size_t keyframeInterval_;
+
+	size_t framesSinceKeyframe_ = 0;
+
+	bool forceKeyframe_ = false;
+
+	std::deque<Checkpoint> ring_;
+
+	/// @brief 最後に記録したフレームの、差分を展開したデータ
+	Array<FullData> lastFull_;
+
+	static Array<Byte> MakeBytes_(const Coro& coro, const ContextStackSnapshot& stack)
+	{
+		const uint64 wakeTime = coro.getWakeTime();
+		const Array<Byte>& stackBytes = stack.bytes();
+
+		Array<Byte> bytes(sizeof(CatState) + sizeof(uint64) + stackBytes.size());
+		std::memcpy(bytes.data(), &coro.getState(), sizeof(CatState));
+		std::memcpy(bytes.data() + sizeof(CatState), &wakeTime, sizeof(uint64));
+
+		if (not stackBytes.isEmpty())
+		{
+			std::memcpy(bytes.data() + sizeof(CatState) + sizeof(uint64), stackBytes.data(), stackBytes.size());
+		}
+
+		return bytes;
+	}
+
+	static bool RestoreCoro_(Coro& coro, const ContextStackSnapshot& stack, const Array<Byte>& bytes)
+	{
+		if (bytes.size() < (sizeof(CatState) + sizeof(uint64)))
+		{
+			return false;
+		}
+
+		ContextStackSnapshot snapshot = stack;
+		snapshot.setBytes(Array<Byte>((bytes.begin() + sizeof(CatState) + sizeof(uint64)), bytes.end()));
+
+		if (not snapshot.restore(coro.getContext()))
+		{
+			return false;
+		}
+
+		CatState state;
+		uint64 wakeTime;
+		std::memcpy(static_cast<void*>(&state), bytes.data(), sizeof(CatState));
+		std::memcpy(&wakeTime, bytes.data() + sizeof(CatState), sizeof(uint64));
+
+		coro.restore(state, wakeTime);
+
+		return true;
+	}
+
+	/// @brief base から変わったブロックだけを rec に保存する
+	static void EncodeDelta_(const Array<Byte>& base, const Array<Byte>& bytes, CoroRecord& rec)
+	{
+		rec.isDelta = true;
+
+		for (size_t offset = 0; offset < bytes.size(); offset += DeltaBlockSize)
+		{
+			const size_t size = Min(DeltaBlockSize, (bytes.size() - offset));
+
+			if (std::memcmp(base.data() + offset, bytes.data() + offset, size) == 0)
+			{
+				continue;
+			}
+
+			// 隣接する区間はまとめる
+			if ((not rec.runs.isEmpty()) && ((rec.runs.back().offset + rec.runs.back().size) == offset))
+			{
+				rec.runs.back().size += static_cast<uint32>(size);
+			}
+			else
+			{
+				rec.runs.push_back({ static_cast<uint32>(offset), static_cast<uint32>(size) });
+			}
+
+			rec.data.insert(rec.data.end(), (bytes.begin() + offset), (bytes.begin() + offset + size));
+		}
+	}
+
+	/// @brief ring_[index] の各コルーチンのデータを、直前のキーフレームから差分を適用して展開する
+	Array<FullData> materialize_(size_t index) const
+	{
+		size_t keyIndex = index;
+
+		while ((0 < keyIndex) && (not ring_[keyIndex].keyframe))
+		{
+			--keyIndex;
+		}
+
+		Array<FullData> full;
+
+		for (size_t i = keyIndex; i <= index; ++i)
+		{
+			Array<FullData> next(Arg::reserve = ring_[i].coros.size());
+
+			size_t baseIndex = 0;
+
+			for (const auto& rec : ring_[i].coros)
+			{
+				if (not rec.isDelta)
+				{
+					next.push_back({ rec.coro.get(), rec.data });
+					continue;
+				}
+
+				while ((baseIndex < full.size()) && (full[baseIndex].coro != rec.coro.get()))
+				{
+					++baseIndex;
+				}
+
+				Array<Byte> bytes = ((baseIndex < full.size()) ? full[baseIndex].bytes : Array<Byte>{});
+				size_t dataOffset = 0;
+
+				for (const auto& run : rec.runs)
+				{
+					if (bytes.size() < (run.offset + run.size))
+					{
+						bytes.resize(run.offset + run.size);
+					}
+
+					std::memcpy(bytes.data() + run.offset, rec.data.data() + dataOffset, run.size);
+					dataOffset += run.size;
+				}
+
+				next.push_back({ rec.coro.get(), std::move(bytes) });
+			}
+
+			full = std::move(next);
+		}
+
+		return full;
+	}
+};
@@ -0,0 +1,436 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "StateBinding.hpp"
+# include "ContextStackSize.hpp"
+
+namespace s3d
+{
+	using namespace AngelScript;
+
+	/// @brief asIScriptContext::SetUserData() に使う型ID
+	namespace CoroutineUserData
+	{
+		/// @brief コルーチンのスケジューラ用の記録 (CoroutineRecord*)
+		inline constexpr asPWORD Record = 0x5100;
+	}
+
+	/// @brief 作成して、まだ解放していないコルーチン用 Context の数
+	/// @remark 長時間の実行でのリークの検出用
+	inline std::atomic<int64>& LiveCoroutineContexts()
+	{
+		static std::atomic<int64> count = 0;
+		return count;
+	}
+
+	/// @brief コルーチンの再開順を決めるための設定
+	///
+	/// 期限のあるコルーチンを期限の早い順に、次に優先度の高い順に再開する。
+	/// どちらも指定しなければ、作成した順に再開する。
+	struct CoroutineSchedule
+	{
+		/// @brief 期限ミスを集計する分類 (CoroutineScheduler::scheduleClass() で得る)
+		uint32 classId = 0;
+
+		/// @brief 大きいほど先に再開する
+		int32 priority = 0;
+
+		/// @brief 再開を始めるまでの期限 (resumeAll() の開始からの秒数)
+		/// @remark 0 にすると「このフレームで最初に実行する」という意味になる
+		Optional<double> deadlineSeconds;
+	};
+
+	/// @brief コルーチンを再開するスレッド
+	enum class CoroutineExecutor : uint8
+	{
+		/// @brief resumeAll() を呼んだスレッド (メインスレッド)
+		Main,
+
+		/// @brief スケジューラのワーカースレッド
+		Worker,
+	};
+
+	/// @brief Select() の待機の状態 (Event, Channel, WaitSet と CoroutineRecord::select) を守るミューテックス
+	/// @remark ワーカースレッドのコルーチンからも使うので、すべての待機の元で1つを共有する
+	inline std::mutex& WaitMutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	struct CoroutineRecord;
+
+	/// @brief Select() で待機中のコルーチンを、待機の元から外すためのインタフェース
+	/// @remark 実装は WaitSet
+	class ISelectWait
+	{
+	public:
+		virtual ~ISelectWait() = default;
+
+		/// @brief 待機をやめ、すべての元から登録を外す
+		/// @remark WaitMutex() を持って呼ぶ
+		virtual void cancelLocked() = 0;
+
+		/// @brief 待機中のコルーチンの記録を waiter に置き換える (コルーチンのムーブ用)
+		/// @remark WaitMutex() を持って呼ぶ
+		virtual void rebindLocked(CoroutineRecord& waiter) = 0;
+	};
+
+	/// @brief コルーチンごとのスケジューラ用の記録
+	///
+	/// Context のユーザーデータ (CoroutineUserData::Record) に登録するので、
+	/// バインディングは Scripting::Binding::CurrentCoroutine() で実行中のコルーチンの記録を O(1) で得られる。
+	/// State に依存しないものだけを置く。
+	struct CoroutineRecord
+	{
+		/// @brief スケジューラ内で一意な番号 (作成順)
+		uint64 id = 0;
+
+		/// @brief 時間計測に使う時計。nullptr なら実時間
+		ISteadyClock* clock = nullptr;
+
+		/// @brief Wait() で待機した場合、再開する時刻 (時計のマイクロ秒)
+		uint64 wakeTime = 0;
+
+		CoroutineSchedule schedule;
+
+		/// @brief 再開するスレッド。SwitchToMainThread() / SwitchToWorker() で切り替わる
+		CoroutineExecutor executor = CoroutineExecutor::Main;
+
+		/// @brief 実行コストを集計するタグ (CoroutineScheduler::costTag() で得る)
+		uint32 tag = 0;
+
+		/// @brief 最後に再開した resumeAll() の番号 (CoroutineScheduler::passCount())
+		uint64 resumedPass = 0;
+
+		/// @brief Select() で待機中の WaitSet。待機していなければ nullptr
+		ISelectWait* select = nullptr;
+
+		/// @brief Select() の待機が終わったときに true にする、スケジューラのフラグ
+		std::atomic<bool>* wakeNotify = nullptr;
+	};
+
+	/// @brief record が Select() で待機中なら、待機をやめる
+	/// @remark 待機の元を起こすスレッドが select を書き換えるので、WaitMutex() を持って読む
+	inline void CancelSelect(CoroutineRecord& record)
+	{
+		std::lock_guard lock{ WaitMutex() };
+
+		if (record.select)
+		{
+			record.select->cancelLocked();
+		}
+	}
+
+	/// @brief AngelScriptのコルーチン
+	///
+	/// AngelScriptのコルーチンはサスペンド時に値を返すことができないので、
+	/// 値をやり取りするための変数(state_)のポインタをコルーチン作成時に渡す。
+	/// スクリプト内部で書き換えられた値を getState() で得ることができる。
+	///
+	/// 実行の前後で状態を比べ、変わったメンバを dirtyProperties() に記録する。
+	/// 記録は clearDirty() するまで残る。
+	///
+	/// @tparam State コルーチンに渡す引数の型
+	template <class State>
+	class ScriptCoroutine
+	{
+	public:
+		ScriptCoroutine(asIScriptContext* ctx = nullptr, const State& initialState = State{})
+			: ctx_{ ctx }, state_{ initialState }, previousState_{ initialState }
+		{
+			if (ctx_ != nullptr)
+			{
+				ctx_->SetArgAddress(0, &state_);
+				ctx_->SetUserData(&record_, CoroutineUserData::Record);
+			}
+		}
+
+		ScriptCoroutine(const ScriptCoroutine&) = delete;
+
+		ScriptCoroutine(ScriptCoroutine&& sc)
+			: ScriptCoroutine{ sc.ctx_, sc.state_ }
+		{
+			previousState_ = sc.previousState_;
+			takeRecord_(sc.record_);
+			dirtyProperties_ = sc.dirtyProperties_;
+			sc.ctx_ = nullptr;
+		}
+
+		~ScriptCoroutine()
+		{
+			release_();
+		}
+
+		ScriptCoroutine& operator =(const ScriptCoroutine&) = delete;
+
+		ScriptCoroutine& operator =(ScriptCoroutine&& sc)
+		{
+			if (this == &sc)
+			{
+				return *this;
+			}
+
+			release_();
+
+			ctx_ = std::exchange(sc.ctx_, nullptr);
+			state_ = sc.state_;
+			previousState_ = sc.previousState_;
+			takeRecord_(sc.record_);
+			dirtyProperties_ = sc.dirtyProperties_;
+
+			// 引数と記録はこのオブジェクトのメンバを指すようにする
+			if (ctx_ != nullptr)
+			{
+				ctx_->SetArgAddress(0, &state_);
+				ctx_->SetUserData(&record_, CoroutineUserData::Record);
+			}
+
+			return *this;
+		}
+
+		/// @brief コルーチンが有効なら実行する
+		///
+		/// 実行前の状態は getPreviousState() で得られる。
+		void operator ()()
+		{
+			if (runnable())
+			{
+				// パディングも含めて揃えておき、比較をメンバの値の違いだけにする
+				std::memcpy(static_cast<void*>(&previousState_), &state_, sizeof(State));
+				ctx_->Execute();
+				dirtyProperties_ |= Scripting::ChangedStateProperties(previousState_, state_);
+			}
+		}
+
+		/// @brief コルーチンが有効か
+		bool runnable() const
+		{
+			if (ctx_ == nullptr) return false;
+
+			const auto state = ctx_->GetState();
+
+			return (
+				state == asEContextState::asEXECUTION_PREPARED ||
+				state == asEContextState::asEXECUTION_SUSPENDED);
+		}
+
+		asIScriptContext* getContext() const
+		{
+			return ctx_;
+		}
+
+		State& getState()
+		{
+			return state_;
+		}
+
+		const State& getState() const
+		{
+			return state_;
+		}
+
+		/// @brief Wait() で待機している場合、再開する時刻 (時計のマイクロ秒)
+		/// @remark 待機していなければ 0
+		uint64 getWakeTime() const
+		{
+			return record_.wakeTime;
+		}
+
+		/// @brief 状態と再開時刻を書き戻す
+		/// @remark 巻き戻し用。補間が飛ばないように直前の状態も同じ値にする
+		void restore(const State& state, uint64 wakeTime)
+		{
+			state_ = state;
+			previousState_ = state;
+			record_.wakeTime = wakeTime;
+			dirtyProperties_ = AllProperties;
+		}
+
+		/// @brief 最後に clearDirty() してから状態が変わったか
+		/// @remark 作成直後と restore() 後は変わったものとして扱う
+		bool isDirty() const
+		{
+			return (dirtyProperties_ != 0);
+		}
+
+		/// @brief 最後に clearDirty() してから変わったメンバ (StateTraits の Properties のインデックスのビット)
+		uint32 dirtyProperties() const
+		{
+			return dirtyProperties_;
+		}
+
+		void clearDirty()
+		{
+			dirtyProperties_ = 0;
+		}
+
+		const CoroutineSchedule& getSchedule() const
+		{
+			return record_.schedule;
+		}
+
+		/// @brief スケジューラ用の記録
+		CoroutineRecord& getRecord()
+		{
+			return record_;
+		}
+
+		const CoroutineRecord& getRecord() const
+		{
+			return record_;
+		}
+
+		/// @brief 直前に実行する前の状態
+		/// @remark 最後に再開したときのものなので、描画の補間には CoroutineScheduler::interpolationBase() を使う
+		const State& getPreviousState() const
+		{
+			return previousState_;
+		}
+
+	private:
+		asIScriptContext* ctx_;
+		State state_;
+		State previousState_;
+		CoroutineRecord record_;
+		uint32 dirtyProperties_ = AllProperties;
+
+		static constexpr uint32 AllProperties = UINT32_MAX;
+
+		/// @brief from の記録を引き継ぐ
+		///
+		/// Select() で待機中なら WaitSet がこの記録を指すように付け替え、
+		/// ムーブ元の release_() が待機をやめたり、起こしたときにムーブ元に書き込んだりしないようにする。
+		void takeRecord_(CoroutineRecord& from)
+		{
+			std::lock_guard lock{ WaitMutex() };
+
+			record_ = from;
+
+			if (record_.select)
+			{
+				record_.select->rebindLocked(record_);
+			}
+
+			from.select = nullptr;
+			from.wakeNotify = nullptr;
+		}
+
+		void release_()
+		{
+			// Select() の待機の元に、この記録を指す登録を残さない
+			CancelSelect(record_);
+
+			if (ctx_ != nullptr)
+			{
+				ctx_->Release();
+				ctx_ = nullptr;
+				--LiveCoroutineContexts();
+			}
+		}
+	};
+
+	/// @brief s3d::Script に getCoroutine() を追加したもの
+	class CustomScript : public Script
+	{
+	public:
+		SIV3D_NODISCARD_CXX20
+		explicit CustomScript(FilePathView path, ScriptCompileOption compileOption = ScriptCompileOption::Default)
+			: Script(path, compileOption)
+			, stackSize_{ isEmpty() ? nullptr : _getModule()->module }
+		{
+		}
+
+		/// @brief コルーチンを作成する
+		/// @tparam CoroState コルーチンに渡す引数の型
+		/// @param decl 関数名
+		/// @param initialState コルーチンに渡す引数の値
+		/// @param tag 実行コストを集計するタグ
+		template <class CoroState>
+		ScriptCoroutine<CoroState> getCoroutine(StringView decl, const CoroState& initialState = CoroState{}, uint32 tag = 0) const
+		{
+			ScriptCoroutine<CoroState> coro{ getCoroutineContext_(decl), initialState };
+			coro.getRecord().tag = tag;
+			return coro;
+		}
+
+		/// @brief decl をコルーチンとして実行する Context の、スタックの初期サイズ(バイト)
+		/// @return 上限を決められず、既定のサイズで作成して拡張に任せる場合は none
+		Optional<uint32> coroutineStackBytes(StringView decl) const
+		{
+			if (isEmpty())
+			{
+				return none;
+			}
+
+			return stackSize_.entryBytes(_getModule()->module->GetFunctionByName(decl.narrow().c_str()));
+		}
+
+		/// @brief coroutineStackBytes() が none になった理由
+		/// @return 大きさを決められた場合は空
+		String coroutineStackUnboundedReason(StringView decl) const
+		{
+			if (isEmpty())
+			{
+				return U"script is empty"_s;
+			}
+
+			return stackSize_.unboundedReason(_getModule()->module->GetFunctionByName(decl.narrow().c_str()));
+		}
+
+	private:
+		/// @brief 読み込み時に求めた、関数ごとのスタックの大きさ
+		ContextStackSize stackSize_;
+
+		/// @brief asEP_INIT_STACK_SIZE を書き換えてから戻すまでを守るミューテックス
+		static std::mutex& StackSizeMutex_()
+		{
+			static std::mutex mutex;
+			return mutex;
+		}
+
+		asIScriptContext* getCoroutineContext_(StringView decl) const
+		{
+			// https://www.angelcode.com/angelscript/sdk/docs/manual/doc_adv_coroutine.html
+
+			if (isEmpty())
+			{
+				return nullptr;
+			}
+
+			asIScriptModule* mod = _getModule()->module;
+
+			asIScriptFunction* funcPtr = mod->GetFunctionByName(decl.narrow().c_str());
+
+			if (funcPtr == nullptr)
+			{
+				return nullptr;
+			}
+
+			// コルーチン用のContextを作成
+			// スタックの最初のブロックは Prepare() で確保するので、その間だけ初期サイズを関数に合わせる
+			// 初期サイズはエンジン全体の設定で、SimulationFarm はワーカースレッドごとにコルーチンを作成するため、
+			// 設定してから戻すまでを StackSizeMutex_() で排他する
+			asIScriptEngine* engine = GetEngine();
+			const Optional<uint32> stackBytes = stackSize_.entryBytes(funcPtr);
+
+			std::lock_guard lock{ StackSizeMutex_() };
+			const asPWORD defaultStackBytes = engine->GetEngineProperty(asEP_INIT_STACK_SIZE);
+
+			if (stackBytes)
+			{
+				engine->SetEngineProperty(asEP_INIT_STACK_SIZE, *stackBytes);
+			}
+
+			asIScriptContext* coctx = engine->CreateContext();
+			coctx->Prepare(funcPtr);
+			++LiveCoroutineContexts();
+
+			if (stackBytes)
+			{
+				engine->SetEngineProperty(asEP_INIT_STACK_SIZE, defaultStackBytes);
+			}
+
+			return coctx;
+		}
+	};
+}
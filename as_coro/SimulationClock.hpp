@@ -0,0 +1,53 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+namespace s3d
+{
+	/// @brief advance() で進める仮想時計
+	///
+	/// Stopwatch や Timer に渡すと、実時間ではなく advance() で進めた時間で計測する。
+	/// 実時間と無関係に進められるので、オフラインで高速にシミュレーションを回すことができる。
+	class SimulationClock : public ISteadyClock
+	{
+	public:
+		uint64 getMicrosec() noexcept override
+		{
+			return microsec();
+		}
+
+		/// @brief 経過時間(マイクロ秒)
+		uint64 microsec() const noexcept
+		{
+			return (nanosec_ / 1000);
+		}
+
+		/// @brief 時計を進める
+		/// @param seconds 進める時間(秒)
+		void advance(double seconds) noexcept
+		{
+			nanosec_ += static_cast<uint64>(Max(seconds, 0.0) * 1e9);
+		}
+
+		/// @brief 経過時間(ナノ秒)
+		uint64 nanosec() const noexcept
+		{
+			return nanosec_;
+		}
+
+		/// @brief 時計を指定した時刻に合わせる
+		/// @param nanosec 経過時間(ナノ秒)
+		void set(uint64 nanosec) noexcept
+		{
+			nanosec_ = nanosec;
+		}
+
+		/// @brief 経過時間(秒)
+		double seconds() const noexcept
+		{
+			return (nanosec_ / 1e9);
+		}
+
+	private:
+		uint64 nanosec_ = 0;
+	};
+}
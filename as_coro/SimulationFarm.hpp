@@ -0,0 +1,469 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "BenchmarkCompare.hpp"
+# include "CatSimulation.hpp"
+# include "CommandLine.hpp"
+# include "ThreadAffinity.hpp"
+
+/// @brief ファームモードの設定
+///
+/// コマンドライン引数で指定する。
+/// --farm=N              N 個のシミュレーションを実行する (これがあるとファームモードになる)
+/// --farm-workers=N      ワーカースレッド数 (0: 論理コア数)
+/// --farm-duration=SEC   1個あたりのシミュレーション時間(仮想時間)
+/// --farm-step=SEC       1ステップの時間
+/// --farm-seed=N         乱数シードの基準値
+/// --farm-report=PATH    レポートの出力先
+/// --farm-repeat=N       同じ設定で N 回繰り返し、ベンチマークの値を集める
+/// --farm-baseline-save=PATH  繰り返しで集めた値をベースラインとして保存する
+/// --farm-baseline=PATH  ベースラインと比べ、有意な改善・悪化を報告する
+struct FarmConfig
+{
+	FilePath scriptPath = U"coro.as";
+
+	FilePath reportPath = U"farm_report.json";
+
+	size_t instanceCount = 100;
+
+	size_t workerCount = 0;
+
+	double duration = 60.0;
+
+	double stepSeconds = (1.0 / 60.0);
+
+	uint64 baseSeed = 12345;
+
+	/// @brief 各インスタンスの spawnInterval はこの範囲を等分して割り当てる
+	double spawnIntervalMin = 0.05;
+
+	double spawnIntervalMax = 1.0;
+
+	/// @brief ねこが出現・移動する領域
+	Rect area{ 0, 0, 800, 600 };
+
+	size_t repetitions = 1;
+
+	Optional<FilePath> baselineSavePath;
+
+	Optional<FilePath> baselinePath;
+
+	/// @brief コマンドライン引数から設定を作る
+	/// @return --farm が無ければ none
+	static Optional<FarmConfig> FromCommandLine(const Array<String>& args)
+	{
+		Optional<FarmConfig> config;
+
+		for (const auto& arg : args)
+		{
+			if (arg == U"--farm")
+			{
+				config.emplace();
+			}
+			else if (const auto v = CommandLine::GetValue(arg, U"--farm"))
+			{
+				config.emplace();
+				config->instanceCount = ParseOr<size_t>(*v, config->instanceCount);
+			}
+		}
+
+		if (not config)
+		{
+			return none;
+		}
+
+		for (const auto& arg : args)
+		{
+			if (const auto v = CommandLine::GetValue(arg, U"--farm-workers"))
+			{
+				config->workerCount = ParseOr<size_t>(*v, config->workerCount);
+			}
+			else if (const auto v = CommandLine::GetValue(arg, U"--farm-duration"))
+			{
+				config->duration = ParseOr<double>(*v, config->duration);
+			}
+			else if (const auto v = CommandLine::GetValue(arg, U"--farm-step"))
+			{
+				config->stepSeconds = ParseOr<double>(*v, config->stepSeconds);
+			}
+			else if (const auto v = CommandLine::GetValue(arg, U"--farm-seed"))
+			{
+				config->baseSeed = ParseOr<uint64>(*v, config->baseSeed);
+			}
+			else if (const auto v = CommandLine::GetValue(arg, U"--farm-report"))
+			{
+				config->reportPath = *v;
+			}
+			else if (const auto v = CommandLine::GetValue(arg, U"--farm-repeat"))
+			{
+				config->repetitions = ParseOr<size_t>(*v, config->repetitions);
+			}
+			else if (const auto v = CommandLine::GetValue(arg, U"--farm-baseline-save"))
+			{
+				config->baselineSavePath = *v;
+			}
+			else if (const auto v = CommandLine::GetValue(arg, U"--farm-baseline"))
+			{
+				config->baselinePath = *v;
+			}
+		}
+
+		config->instanceCount = Max<size_t>(config->instanceCount, 1);
+		config->repetitions = Max<size_t>(config->repetitions, 1);
+		config->stepSeconds = Max(config->stepSeconds, 1e-4);
+
+		return config;
+	}
+};
+
+/// @brief ファームの1インスタンス分の結果
+struct FarmInstanceResult
+{
+	size_t index = 0;
+
+	uint64 seed = 0;
+
+	CatSimulationParams params;
+
+	CatSimulationStats stats;
+
+	/// @brief 終了時のコルーチン数
+	size_t finalAlive = 0;
+
+	/// @brief 実行にかかった実時間(秒)
+	double wallSeconds = 0.0;
+
+	/// @brief 実行中のデータ TLB ミスの回数 (計測できた場合)
+	Optional<uint64> tlbMisses;
+
+	/// @brief コルーチンの確保に使った領域のうち、ラージページの分(バイト)
+	size_t largePageBytes = 0;
+
+	/// @brief コルーチンの確保に使った領域のうち、Transparent Huge Pages を依頼した分(バイト)
+	size_t transparentPageBytes = 0;
+
+	/// @brief コルーチンの確保に使った領域のうち、通常のページの分(バイト)
+	size_t normalPageBytes = 0;
+
+	/// @brief タグごとの実行コスト (再開に掛かった時間の多い順)
+	Array<CoroutineCost> costs;
+
+	/// @brief スクリプトのコンパイルに成功し、最後まで実行できたか
+	bool completed = false;
+};
+
+/// @brief 独立したねこシミュレーションを複数のスレッドで並列に実行する
+///
+/// インスタンスごとにスクリプトのモジュール・スケジューラ・仮想時計を持ち、
+/// インスタンス間で共有する可変状態は無い (ワーカーへの割り当てに使うカウンタを除く)。
+/// エンジンは共有するので、スクリプトのコンパイルはコンストラクタでメインスレッドから行う。
+/// 乱数はスレッドごとのエンジンを、インスタンスの開始時にシードし直して使う。
+class SimulationFarm
+{
+public:
+	/// @brief レポートに載せる、インスタンスごとの実行コストのタグの数
+	static constexpr size_t CostReportTags = 5;
+
+	explicit SimulationFarm(const FarmConfig& config)
+		: config_{ config }
+	{
+		instances_.reserve(config_.instanceCount);
+
+		for (size_t i = 0; i < config_.instanceCount; ++i)
+		{
+			const double t = ((config_.instanceCount == 1) ? 0.0 : (static_cast<double>(i) / (config_.instanceCount - 1)));
+
+			Instance instance;
+			instance.script = std::make_unique<CustomScript>(config_.scriptPath);
+			instance.result.index = i;
+			instance.result.seed = (config_.baseSeed + i);
+			instance.result.params.area = config_.area;
+			instance.result.params.spawnInterval = Math::Lerp(config_.spawnIntervalMin, config_.spawnIntervalMax, t);
+
+			instances_.push_back(std::move(instance));
+		}
+	}
+
+	SimulationFarm(const SimulationFarm&) = delete;
+
+	SimulationFarm& operator =(const SimulationFarm&) = delete;
+
+	~SimulationFarm()
+	{
+		cancel();
+		wait();
+	}
+
+	/// @brief ワーカースレッドを起動する
+	void start()
+	{
+		if (not workers_.isEmpty())
+		{
+			return;
+		}
+
+		const size_t workerCount = Min(((config_.workerCount == 0) ? ThreadAffinity::LogicalCoreCount() : config_.workerCount), instances_.size());
+
+		activeWorkers_ = workerCount;
+		elapsedSeconds_ = 0.0;
+		stopwatch_.restart();
+
+		for (size_t i = 0; i < workerCount; ++i)
+		{
+			workers_.emplace_back([this, i] { workerMain_(i); });
+		}
+	}
+
+	/// @brief 実行中のインスタンスを打ち切る
+	void cancel()
+	{
+		canceled_ = true;
+	}
+
+	/// @brief ワーカースレッドの終了を待つ
+	void wait()
+	{
+		for (auto& worker : workers_)
+		{
+			if (worker.joinable())
+			{
+				worker.join();
+			}
+		}
+	}
+
+	bool isDone() const
+	{
+		return (completed_ == instances_.size());
+	}
+
+	size_t completed() const
+	{
+		return completed_;
+	}
+
+	size_t instanceCount() const
+	{
+		return instances_.size();
+	}
+
+	/// @brief start() から最後のワーカースレッドがインスタンスを実行し終えるまでの時間(秒)
+	/// @remark wait() の後に呼ぶ
+	double elapsedSeconds() const
+	{
+		return elapsedSeconds_;
+	}
+
+	/// @brief ベンチマークとして比べる指標 (benchmarkValues() の順)
+	static Array<BenchmarkCompare::Metric> BenchmarkMetrics()
+	{
+		return{
+			{ U"stepsPerSecond", BenchmarkCompare::Better::Higher },
+			{ U"microsPerStep", BenchmarkCompare::Better::Lower },
+			{ U"tlbMissesPerStep", BenchmarkCompare::Better::Lower },
+		};
+	}
+
+	/// @brief この実行のベンチマークの値
+	/// @return BenchmarkMetrics() の順。計測できなかった指標は none
+	/// @remark wait() の後に呼ぶ
+	Array<Optional<double>> benchmarkValues() const
+	{
+		uint64 totalSteps = 0;
+		double totalWallSeconds = 0.0;
+		Optional<uint64> totalTlbMisses;
+
+		for (const auto& instance : instances_)
+		{
+			totalSteps += instance.result.stats.steps;
+			totalWallSeconds += instance.result.wallSeconds;
+
+			if (instance.result.tlbMisses)
+			{
+				totalTlbMisses = (totalTlbMisses.value_or(0) + *instance.result.tlbMisses);
+			}
+		}
+
+		if (totalSteps == 0)
+		{
+			return{ none, none, none };
+		}
+
+		const double elapsed = elapsedSeconds_;
+
+		return{
+			((elapsed > 0.0) ? Optional<double>{ totalSteps / elapsed } : none),
+			(totalWallSeconds * 1e6 / totalSteps),
+			(totalTlbMisses ? Optional<double>{ static_cast<double>(*totalTlbMisses) / totalSteps } : none),
+		};
+	}
+
+	/// @brief 全インスタンスの結果をまとめたレポートを作る
+	/// @remark wait() の後に呼ぶ
+	JSON makeReport() const
+	{
+		JSON report;
+
+		uint64 totalSteps = 0;
+		uint64 totalSpawned = 0;
+		uint64 totalRemoved = 0;
+		size_t maxPeakAlive = 0;
+		size_t completedCount = 0;
+		double totalWallSeconds = 0.0;
+		Optional<uint64> totalTlbMisses;
+
+		for (const auto& instance : instances_)
+		{
+			const auto& result = instance.result;
+
+			JSON entry;
+			entry[U"index"] = result.index;
+			entry[U"seed"] = result.seed;
+			entry[U"spawnInterval"] = result.params.spawnInterval;
+			entry[U"completed"] = result.completed;
+			entry[U"steps"] = result.stats.steps;
+			entry[U"spawned"] = result.stats.spawned;
+			entry[U"removed"] = result.stats.removed;
+			entry[U"peakAlive"] = result.stats.peakAlive;
+			entry[U"finalAlive"] = result.finalAlive;
+			entry[U"wallSeconds"] = result.wallSeconds;
+			entry[U"largePageBytes"] = result.largePageBytes;
+			entry[U"transparentPageBytes"] = result.transparentPageBytes;
+			entry[U"normalPageBytes"] = result.normalPageBytes;
+			entry[U"costs"] = ToJSON(result.costs);
+
+			if (result.tlbMisses)
+			{
+				entry[U"tlbMisses"] = *result.tlbMisses;
+				totalTlbMisses = (totalTlbMisses.value_or(0) + *result.tlbMisses);
+			}
+
+			report[U"instances"].push_back(entry);
+
+			totalSteps += result.stats.steps;
+			totalSpawned += result.stats.spawned;
+			totalRemoved += result.stats.removed;
+			maxPeakAlive = Max(maxPeakAlive, result.stats.peakAlive);
+			completedCount += result.completed;
+			totalWallSeconds += result.wallSeconds;
+		}
+
+		const double elapsed = elapsedSeconds_;
+
+		report[U"summary"][U"instanceCount"] = instances_.size();
+		report[U"summary"][U"completed"] = completedCount;
+		report[U"summary"][U"workerCount"] = workers_.size();
+		report[U"summary"][U"duration"] = config_.duration;
+		report[U"summary"][U"stepSeconds"] = config_.stepSeconds;
+		report[U"summary"][U"totalSteps"] = totalSteps;
+		report[U"summary"][U"totalSpawned"] = totalSpawned;
+		report[U"summary"][U"totalRemoved"] = totalRemoved;
+		report[U"summary"][U"maxPeakAlive"] = maxPeakAlive;
+		report[U"summary"][U"meanSpawned"] = (static_cast<double>(totalSpawned) / instances_.size());
+		report[U"summary"][U"elapsedSeconds"] = elapsed;
+		report[U"summary"][U"cpuSeconds"] = totalWallSeconds;
+		report[U"summary"][U"stepsPerSecond"] = ((elapsed > 0.0) ? (totalSteps / elapsed) : 0.0);
+
+		if (totalTlbMisses)
+		{
+			report[U"summary"][U"tlbMisses"] = *totalTlbMisses;
+			report[U"summary"][U"tlbMissesPerStep"] = ((totalSteps > 0) ? (static_cast<double>(*totalTlbMisses) / totalSteps) : 0.0);
+		}
+
+		return report;
+	}
+
+private:
+	struct Instance
+	{
+		std::unique_ptr<CustomScript> script;
+
+		FarmInstanceResult result;
+	};
+
+	FarmConfig config_;
+
+	Array<Instance> instances_;
+
+	Array<std::thread> workers_;
+
+	std::atomic<size_t> next_ = 0;
+
+	std::atomic<size_t> completed_ = 0;
+
+	std::atomic<bool> canceled_ = false;
+
+	Stopwatch stopwatch_;
+
+	/// @brief インスタンスを実行中のワーカースレッドの数
+	std::atomic<size_t> activeWorkers_ = 0;
+
+	/// @brief 最後のワーカースレッドが実行し終えたときの stopwatch_ の値 (wait() で同期する)
+	double elapsedSeconds_ = 0.0;
+
+	void workerMain_(size_t workerIndex)
+	{
+		ThreadAffinity::PinCurrentThread(workerIndex);
+
+		for (;;)
+		{
+			const size_t index = next_.fetch_add(1);
+
+			if ((instances_.size() <= index) || canceled_)
+			{
+				break;
+			}
+
+			runInstance_(instances_[index]);
+
+			++completed_;
+		}
+
+		// wait() した時点ではなく、最後のインスタンスが終わった時点までを計測時間にする
+		if (--activeWorkers_ == 0)
+		{
+			elapsedSeconds_ = stopwatch_.sF();
+		}
+
+		// AngelScript がこのスレッド用に確保したメモリを解放する
+		asThreadCleanup();
+	}
+
+	void runInstance_(Instance& instance)
+	{
+		auto& result = instance.result;
+
+		if (instance.script->isEmpty())
+		{
+			return;
+		}
+
+		Reseed(result.seed);
+
+		const Stopwatch wall{ StartImmediately::Yes };
+		{
+			CatSimulation simulation{ *instance.script, result.params };
+
+			const uint64 steps = static_cast<uint64>(config_.duration / config_.stepSeconds);
+
+			const LargePages::TlbMissCounter tlbMisses;
+
+			for (uint64 i = 0; (i < steps) && (not canceled_); ++i)
+			{
+				simulation.update(config_.stepSeconds);
+			}
+
+			result.tlbMisses = tlbMisses.read();
+
+			const auto& pages = simulation.scheduler().pages();
+			result.largePageBytes = pages.reservedBytes(LargePages::PageKind::Large);
+			result.transparentPageBytes = pages.reservedBytes(LargePages::PageKind::Transparent);
+			result.normalPageBytes = pages.reservedBytes(LargePages::PageKind::Normal);
+
+			result.stats = simulation.stats();
+			result.finalAlive = simulation.scheduler().size();
+			result.costs = TopCosts(simulation.scheduler().costs(), CostReportTags);
+			result.completed = (not canceled_);
+		}
+		result.wallSeconds = wall.sF();
+	}
+};
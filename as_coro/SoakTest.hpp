@@ -0,0 +1,289 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "CatSimulation.hpp"
+# include "CommandLine.hpp"
+# include "MemoryGovernor.hpp"
+
+/// @brief ソークモードの設定
+///
+/// コマンドライン引数で指定する。
+/// --soak=SEC            SEC 秒(実時間)のあいだシミュレーションを回し続ける (これがあるとソークモードになる)
+/// --soak-interval=SEC   計測の間隔(実時間)
+/// --soak-warmup=SEC     増加の判定から除く最初の時間(実時間)。ねこの数が落ち着くまで
+/// --soak-report=PATH    レポートの出力先
+struct SoakConfig
+{
+	double duration = 3600.0;
+
+	double sampleInterval = 10.0;
+
+	double warmup = 60.0;
+
+	double stepSeconds = (1.0 / 60.0);
+
+	FilePath reportPath = U"soak_report.json";
+
+	/// @brief コマンドライン引数から設定を作る
+	/// @return --soak が無ければ none
+	static Optional<SoakConfig> FromCommandLine(const Array<String>& args)
+	{
+		const auto duration = CommandLine::Find<double>(args, U"--soak");
+
+		if (not duration)
+		{
+			return none;
+		}
+
+		SoakConfig config;
+		config.duration = Max(*duration, 1.0);
+		config.sampleInterval = Max(CommandLine::Find<double>(args, U"--soak-interval").value_or(config.sampleInterval), 0.1);
+		config.warmup = Clamp(CommandLine::Find<double>(args, U"--soak-warmup").value_or(Min(config.warmup, (config.duration * 0.1))), 0.0, config.duration);
+		config.reportPath = CommandLine::Find<String>(args, U"--soak-report").value_or(config.reportPath);
+
+		return config;
+	}
+};
+
+/// @brief ソークモードで計測した1回分の値
+struct SoakSample
+{
+	/// @brief 開始からの実時間(秒)
+	double seconds = 0.0;
+
+	/// @brief プロセスの常駐メモリ(バイト)
+	double residentBytes = 0.0;
+
+	/// @brief スクリプトのガベージコレクタが管理しているオブジェクトの数
+	double scriptObjects = 0.0;
+
+	/// @brief 解放していないコルーチン用 Context の数
+	double contexts = 0.0;
+
+	/// @brief スケジューラのコルーチンの数
+	double coroutines = 0.0;
+
+	/// @brief スケジューラのプールが確保した領域(バイト)
+	double poolBytes = 0.0;
+};
+
+/// @brief 1つの値の増加傾向の判定結果
+struct GrowthResult
+{
+	String name;
+
+	/// @brief 最小二乗法による傾き(1時間あたり)
+	double slopePerHour = 0.0;
+
+	/// @brief 傾きの t 値
+	double tValue = 0.0;
+
+	/// @brief 判定に使った期間の増加量 (傾き × 期間)
+	double growth = 0.0;
+
+	/// @brief 増え続けていると判定したか
+	bool growing = false;
+};
+
+/// @brief 長時間シミュレーションを回し続け、メモリなどの増加を検出する
+///
+/// 作成と削除が釣り合った状態が続けば、計測値は一定の範囲で上下するだけになる。
+/// ウォームアップ後の計測値に回帰直線を当てはめ、傾きが有意に正で、
+/// 増加量が無視できない大きさであれば増え続けていると判定する。
+class SoakTest
+{
+public:
+	/// @brief 増加と判定する t 値の下限
+	static constexpr double SignificantT = 4.0;
+
+	/// @brief 判定に必要な計測回数
+	static constexpr size_t MinSamples = 8;
+
+	SoakTest(const CustomScript& script, const SoakConfig& config)
+		: config_{ config }
+		, simulation_{ script, CatSimulationParams{} }
+	{
+	}
+
+	/// @brief シミュレーションを進め、間隔ごとに計測する
+	/// @param budget この呼び出しで使う実時間
+	/// @return 設定した時間が過ぎたら false
+	bool update(const Duration& budget)
+	{
+		const Stopwatch slice{ StartImmediately::Yes };
+
+		while (slice.sF() < budget.count())
+		{
+			simulation_.update(config_.stepSeconds);
+		}
+
+		if ((samples_.isEmpty() || ((samples_.back().seconds + config_.sampleInterval) <= stopwatch_.sF())))
+		{
+			samples_.push_back(sample_());
+		}
+
+		return (stopwatch_.sF() < config_.duration);
+	}
+
+	/// @brief 開始からの実時間(秒)
+	double elapsedSeconds() const
+	{
+		return stopwatch_.sF();
+	}
+
+	const CatSimulation& simulation() const
+	{
+		return simulation_;
+	}
+
+	const Array<SoakSample>& samples() const
+	{
+		return samples_;
+	}
+
+	/// @brief 各値の増加傾向を判定する
+	Array<GrowthResult> analyze() const
+	{
+		return{
+			testGrowth_(U"residentBytes", &SoakSample::residentBytes, (1024.0 * 1024.0)),
+			testGrowth_(U"scriptObjects", &SoakSample::scriptObjects, 100.0),
+			testGrowth_(U"contexts", &SoakSample::contexts, 10.0),
+			testGrowth_(U"coroutines", &SoakSample::coroutines, 10.0),
+			testGrowth_(U"poolBytes", &SoakSample::poolBytes, (1024.0 * 1024.0)),
+		};
+	}
+
+	/// @brief 計測値と判定結果のレポート
+	JSON makeReport() const
+	{
+		JSON report;
+		report[U"duration"] = config_.duration;
+		report[U"warmup"] = config_.warmup;
+		report[U"steps"] = simulation_.stats().steps;
+		report[U"spawned"] = simulation_.stats().spawned;
+		report[U"removed"] = simulation_.stats().removed;
+
+		for (const auto& sample : samples_)
+		{
+			JSON entry;
+			entry[U"seconds"] = sample.seconds;
+			entry[U"residentBytes"] = sample.residentBytes;
+			entry[U"scriptObjects"] = sample.scriptObjects;
+			entry[U"contexts"] = sample.contexts;
+			entry[U"coroutines"] = sample.coroutines;
+			entry[U"poolBytes"] = sample.poolBytes;
+			report[U"samples"].push_back(entry);
+		}
+
+		bool growing = false;
+
+		for (const auto& result : analyze())
+		{
+			JSON entry;
+			entry[U"name"] = result.name;
+			entry[U"slopePerHour"] = result.slopePerHour;
+			entry[U"tValue"] = result.tValue;
+			entry[U"growth"] = result.growth;
+			entry[U"growing"] = result.growing;
+			report[U"growth"].push_back(entry);
+
+			growing |= result.growing;
+		}
+
+		report[U"growing"] = growing;
+
+		return report;
+	}
+
+private:
+	SoakConfig config_;
+
+	CatSimulation simulation_;
+
+	Stopwatch stopwatch_{ StartImmediately::Yes };
+
+	Array<SoakSample> samples_;
+
+	SoakSample sample_() const
+	{
+		asUINT scriptObjects = 0;
+		Script::GetEngine()->GetGCStatistics(&scriptObjects);
+
+		const auto& pages = simulation_.scheduler().pages();
+
+		return SoakSample{
+			.seconds = stopwatch_.sF(),
+			.residentBytes = static_cast<double>(MemoryGovernor::ResidentBytes()),
+			.scriptObjects = static_cast<double>(scriptObjects),
+			.contexts = static_cast<double>(LiveCoroutineContexts().load()),
+			.coroutines = static_cast<double>(simulation_.scheduler().size()),
+			.poolBytes = static_cast<double>(pages.reservedBytes(LargePages::PageKind::Large)
+				+ pages.reservedBytes(LargePages::PageKind::Transparent) + pages.reservedBytes(LargePages::PageKind::Normal)),
+		};
+	}
+
+	/// @brief ウォームアップ後の計測値に回帰直線を当てはめて判定する
+	/// @param minGrowth 増加と判定する、期間全体での増加量の下限
+	GrowthResult testGrowth_(StringView name, double SoakSample::* member, double minGrowth) const
+	{
+		GrowthResult result{ .name = String{ name } };
+
+		Array<Vec2> points;
+
+		for (const auto& sample : samples_)
+		{
+			if (config_.warmup <= sample.seconds)
+			{
+				points.emplace_back(sample.seconds, (sample.*member));
+			}
+		}
+
+		const size_t n = points.size();
+
+		if (n < MinSamples)
+		{
+			return result;
+		}
+
+		Vec2 mean{ 0, 0 };
+
+		for (const auto& point : points)
+		{
+			mean += point;
+		}
+
+		mean /= static_cast<double>(n);
+
+		double sxx = 0.0, sxy = 0.0;
+
+		for (const auto& point : points)
+		{
+			sxx += ((point.x - mean.x) * (point.x - mean.x));
+			sxy += ((point.x - mean.x) * (point.y - mean.y));
+		}
+
+		if (sxx <= 0.0)
+		{
+			return result;
+		}
+
+		const double slope = (sxy / sxx);
+		const double intercept = (mean.y - (slope * mean.x));
+
+		double residual = 0.0;
+
+		for (const auto& point : points)
+		{
+			const double e = (point.y - (intercept + (slope * point.x)));
+			residual += (e * e);
+		}
+
+		const double standardError = std::sqrt((residual / static_cast<double>(n - 2)) / sxx);
+
+		result.slopePerHour = (slope * 3600.0);
+		result.tValue = ((standardError > 0.0) ? (slope / standardError) : ((slope > 0.0) ? Math::Inf : 0.0));
+		result.growth = (slope * (points.back().x - points.front().x));
+		result.growing = ((SignificantT < result.tValue) && (minGrowth < result.growth));
+
+		return result;
+	}
+};
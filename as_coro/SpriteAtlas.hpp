@@ -0,0 +1,81 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+/// @brief 複数の画像を1枚のテクスチャにまとめたもの
+///
+/// 同じテクスチャの描画は1回の描画命令にまとめられるので、
+/// どの組み合わせのスプライトを描いても、テクスチャを切り替えずに済む。
+/// スプライトの番号は画像を渡した順 (0 から)。
+class SpriteAtlas
+{
+public:
+	SpriteAtlas() = default;
+
+	/// @param images スプライトの画像
+	/// @param padding 隣のスプライトが縮小時に滲まないようにあける間隔(ピクセル)
+	explicit SpriteAtlas(const Array<Image>& images, int32 padding = 4)
+	{
+		if (images.isEmpty())
+		{
+			return;
+		}
+
+		// 横に並べる。大きさが違う画像は一番大きいセルに左上詰めで置く
+		Size cellSize{ 0, 0 };
+
+		for (const auto& image : images)
+		{
+			cellSize.x = Max(cellSize.x, image.width());
+			cellSize.y = Max(cellSize.y, image.height());
+		}
+
+		const int32 stride = (cellSize.x + padding);
+
+		Image atlas{ static_cast<size_t>(stride * static_cast<int32>(images.size())), static_cast<size_t>(cellSize.y), Color{ 0, 0, 0, 0 } };
+
+		for (size_t i = 0; i < images.size(); ++i)
+		{
+			const Point pos{ (stride * static_cast<int32>(i)), 0 };
+			images[i].overwrite(atlas, pos);
+			regions_.push_back(Rect{ pos, images[i].size() });
+		}
+
+		texture_ = Texture{ atlas, TextureDesc::Mipped };
+	}
+
+	/// @brief スプライトのテクスチャ領域
+	/// @param id スプライトの番号 (CatState::sprite)。範囲外の場合は折り返す (負の番号は末尾から)
+	/// @return スプライトが無ければ空の領域
+	TextureRegion operator ()(int32 id) const
+	{
+		if (regions_.isEmpty())
+		{
+			return{};
+		}
+
+		const int32 count = static_cast<int32>(regions_.size());
+		const Rect& rect = regions_[((id % count) + count) % count];
+		return texture_(rect.x, rect.y, rect.w, rect.h);
+	}
+
+	/// @brief スプライトの数
+	size_t size() const
+	{
+		return regions_.size();
+	}
+
+	bool isEmpty() const
+	{
+		return regions_.isEmpty();
+	}
+
+	const Texture& texture() const
+	{
+		return texture_;
+	}
+
+private:
+	Texture texture_;
+
+	Array<Rect> regions_;
+};
@@ -0,0 +1,148 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+/// @brief 起動時の初期化の各段階にかかった時間を計測する
+///
+/// Scope を入れ子にすると、段階の中の内訳も計測できる。
+/// キャッシュなどを追加したときは、その段階を Scope で囲めば効果をレポートで比較できる。
+class StartupProfiler
+{
+public:
+	/// @brief 計測した1段階
+	struct Phase
+	{
+		String name;
+
+		/// @brief 入れ子の深さ (最上位は 0)
+		size_t depth = 0;
+
+		/// @brief 計測開始からこの段階の開始までの時間(秒)
+		double startSeconds = 0.0;
+
+		/// @brief この段階にかかった時間(秒)
+		double durationSeconds = 0.0;
+
+		/// @brief 段階の中で記録したメモ
+		Array<String> notes;
+	};
+
+	/// @brief スコープの間を1段階として計測する
+	class Scope
+	{
+	public:
+		Scope(StartupProfiler& profiler, StringView name)
+			: profiler_{ profiler }
+		{
+			profiler_.begin(name);
+		}
+
+		Scope(const Scope&) = delete;
+
+		Scope& operator =(const Scope&) = delete;
+
+		~Scope()
+		{
+			profiler_.end();
+		}
+
+	private:
+		StartupProfiler& profiler_;
+	};
+
+	StartupProfiler()
+		: stopwatch_{ StartImmediately::Yes }
+	{
+	}
+
+	/// @brief 段階を開始する
+	void begin(StringView name)
+	{
+		open_.push_back(phases_.size());
+		phases_.push_back({ .name = String{ name }, .depth = (open_.size() - 1), .startSeconds = stopwatch_.sF() });
+	}
+
+	/// @brief 最後に開始した段階を終了する
+	void end()
+	{
+		if (open_.isEmpty())
+		{
+			return;
+		}
+
+		Phase& phase = phases_[open_.back()];
+		phase.durationSeconds = (stopwatch_.sF() - phase.startSeconds);
+		open_.pop_back();
+	}
+
+	/// @brief 実行中の段階にメモを記録する
+	/// @remark 段階の外で呼んだ場合は無視する
+	void note(StringView text)
+	{
+		if (not open_.isEmpty())
+		{
+			phases_[open_.back()].notes.push_back(String{ text });
+		}
+	}
+
+	const Array<Phase>& phases() const
+	{
+		return phases_;
+	}
+
+	/// @brief 計測開始からの経過時間(秒)
+	double elapsedSeconds() const
+	{
+		return stopwatch_.sF();
+	}
+
+	/// @brief 段階を入れ子で並べたテキストのレポート
+	String format() const
+	{
+		String text = U"startup: {:.2f} ms\n"_fmt(stopwatch_.msF());
+
+		for (const auto& phase : phases_)
+		{
+			text += U"{}{:<28} {:>9.3f} ms\n"_fmt(String(((phase.depth + 1) * 2), U' '), phase.name, (phase.durationSeconds * 1000.0));
+
+			for (const auto& note : phase.notes)
+			{
+				text += U"{}- {}\n"_fmt(String(((phase.depth + 2) * 2), U' '), note);
+			}
+		}
+
+		return text;
+	}
+
+	/// @brief JSON のレポート
+	JSON toJSON() const
+	{
+		JSON json;
+		json[U"totalSeconds"] = stopwatch_.sF();
+
+		for (const auto& phase : phases_)
+		{
+			JSON entry;
+			entry[U"name"] = phase.name;
+			entry[U"depth"] = phase.depth;
+			entry[U"startSeconds"] = phase.startSeconds;
+			entry[U"durationSeconds"] = phase.durationSeconds;
+
+			for (const auto& note : phase.notes)
+			{
+				entry[U"notes"].push_back(note);
+			}
+
+			json[U"phases"].push_back(entry);
+		}
+
+		return json;
+	}
+
+private:
+	Stopwatch stopwatch_;
+
+	Array<Phase> phases_;
+
+	/// @brief 実行中の段階の phases_ のインデックス
+	Array<size_t> open_;
+};
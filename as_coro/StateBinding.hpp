@@ -0,0 +1,304 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+namespace Scripting
+{
+	using namespace AngelScript;
+
+	/// @brief メンバの値の種類 (asOBJ_APP_CLASS_ALLFLOATS / ALLINTS の判定に使う)
+	enum class ScalarKind
+	{
+		/// @brief 浮動小数点数だけでできている
+		Float,
+
+		/// @brief 整数 (ポインタ・bool を含む) だけでできている
+		Int,
+
+		/// @brief 混在している、または不明
+		Mixed,
+	};
+
+	/// @brief 型の値の種類
+	/// @remark 複合型は必要に応じて特殊化する
+	template <class Type>
+	struct ScalarKindOf
+	{
+		static constexpr ScalarKind value = (std::is_floating_point_v<Type> ? ScalarKind::Float
+			: ((std::is_integral_v<Type> || std::is_pointer_v<Type> || std::is_enum_v<Type>) ? ScalarKind::Int : ScalarKind::Mixed));
+	};
+
+	template <>
+	struct ScalarKindOf<Vec2>
+	{
+		static constexpr ScalarKind value = ScalarKind::Float;
+	};
+
+	/// @brief バイト列のハッシュ値 (FNV-1a, 64 ビット)
+	/// @param seed 続けてハッシュする場合は前の結果
+	inline uint64 HashBytes(const void* data, size_t size, uint64 seed = 0xcbf29ce484222325)
+	{
+		const Byte* p = static_cast<const Byte*>(data);
+
+		for (size_t i = 0; i < size; ++i)
+		{
+			seed = ((seed ^ static_cast<uint8>(p[i])) * 0x100000001b3);
+		}
+
+		return seed;
+	}
+
+	/// @brief 実行ごとに変わらない値だけから求めたハッシュ値
+	/// @remark ポインタなど実行ごとに変わる値を含む型は特殊化する
+	template <class Type>
+	uint64 HashStateValue(const void* value, uint64 seed)
+	{
+		static_assert(std::has_unique_object_representations_v<Type> || std::is_floating_point_v<Type> || std::is_same_v<Type, Vec2>,
+			"HashStateValue: specialize for types with padding or pointers");
+
+		return HashBytes(value, sizeof(Type), seed);
+	}
+
+	/// @brief Stopwatch は時計のポインタを除き、状態と経過時間から求める
+	template <>
+	inline uint64 HashStateValue<Stopwatch>(const void* value, uint64 seed)
+	{
+		const Stopwatch& stopwatch = *static_cast<const Stopwatch*>(value);
+		const int64 values[] = { stopwatch.isStarted(), stopwatch.isPaused(), stopwatch.us() };
+		return HashBytes(values, sizeof(values), seed);
+	}
+
+	/// @brief スクリプトに公開する状態型のメンバ1つ分
+	struct StateProperty
+	{
+		/// @brief スクリプトでの型名
+		std::string_view type;
+
+		/// @brief スクリプトでのメンバ名
+		std::string_view name;
+
+		size_t offset;
+
+		size_t size;
+
+		ScalarKind kind;
+
+		/// @brief メンバの値のハッシュ値を求める関数 (HashStateValue)
+		uint64(*hash)(const void* value, uint64 seed);
+	};
+
+	/// @brief 状態型をスクリプトに公開するための記述
+	///
+	/// 型ごとに特殊化して、Name と Properties (SCRIPT_STATE_PROPERTY の配列) を定義する。
+	/// RegisterStateTypes() でまとめて登録し、レイアウトはコンパイル時と登録後に検査する。
+	template <class State>
+	struct StateTraits;
+
+	template <class Struct, class Type, class MemberType>
+	consteval StateProperty MakeStateProperty(std::string_view type, std::string_view name, size_t offset)
+	{
+		static_assert(std::is_same_v<Type, MemberType>, "SCRIPT_STATE_PROPERTY: the declared type does not match the member");
+		return StateProperty{ type, name, offset, sizeof(Type), ScalarKindOf<Type>::value, &HashStateValue<Type> };
+	}
+
+	/// @brief Properties の配列の要素を作る
+	/// @param Struct 状態型
+	/// @param Type メンバの型 (スクリプトでも同じ名前で登録されている型)
+	/// @param Member メンバ名
+# define SCRIPT_STATE_PROPERTY(Struct, Type, Member) \
+	::Scripting::MakeStateProperty<Struct, Type, decltype(Struct::Member)>(#Type, #Member, offsetof(Struct, Member))
+
+	/// @brief メンバが重ならず、型の範囲内に昇順に並んでいるか
+	template <class State>
+	consteval bool IsValidStateLayout()
+	{
+		size_t end = 0;
+
+		for (const auto& property : StateTraits<State>::Properties)
+		{
+			if ((property.offset < end) || (sizeof(State) < (property.offset + property.size)))
+			{
+				return false;
+			}
+
+			end = (property.offset + property.size);
+		}
+
+		return true;
+	}
+
+	/// @brief 状態型の変更されたメンバ
+	/// @return Properties のインデックスのビット。StateTraits が無い型は、全体のどこかが変わっていれば全ビット
+	template <class State>
+	uint32 ChangedStateProperties(const State& before, const State& after)
+	{
+		static_assert(std::is_trivially_copyable_v<State>);
+
+		const Byte* a = reinterpret_cast<const Byte*>(&before);
+		const Byte* b = reinterpret_cast<const Byte*>(&after);
+
+		if constexpr (requires { StateTraits<State>::Properties; })
+		{
+			static_assert(StateTraits<State>::Properties.size() <= 32);
+
+			uint32 mask = 0;
+
+			for (size_t i = 0; i < StateTraits<State>::Properties.size(); ++i)
+			{
+				const auto& property = StateTraits<State>::Properties[i];
+
+				if (std::memcmp((a + property.offset), (b + property.offset), property.size) != 0)
+				{
+					mask |= (1u << i);
+				}
+			}
+
+			return mask;
+		}
+		else
+		{
+			return ((std::memcmp(a, b, sizeof(State)) != 0) ? UINT32_MAX : 0);
+		}
+	}
+
+	/// @brief 状態のハッシュ値
+	/// @remark StateTraits のメンバだけを使うので、パディングや実行ごとに変わるポインタには左右されない
+	template <class State>
+	uint64 HashState(const State& state, uint64 seed = 0xcbf29ce484222325)
+	{
+		const Byte* p = reinterpret_cast<const Byte*>(&state);
+
+		for (const auto& property : StateTraits<State>::Properties)
+		{
+			seed = property.hash((p + property.offset), seed);
+		}
+
+		return seed;
+	}
+
+	/// @brief 値渡しで効率よく受け渡せるように、型に合った asOBJ_APP_* フラグを求める
+	template <class State>
+	asQWORD GetStateAppFlags()
+	{
+		asQWORD flags = asGetTypeTraits<State>();
+
+		bool allFloats = true;
+		bool allInts = true;
+
+		for (const auto& property : StateTraits<State>::Properties)
+		{
+			allFloats &= (property.kind == ScalarKind::Float);
+			allInts &= (property.kind == ScalarKind::Int);
+		}
+
+		if (allFloats)
+		{
+			flags |= asOBJ_APP_CLASS_ALLFLOATS;
+		}
+		else if (allInts)
+		{
+			flags |= asOBJ_APP_CLASS_ALLINTS;
+		}
+
+		if constexpr (alignof(State) == 8)
+		{
+			flags |= asOBJ_APP_CLASS_ALIGN8;
+		}
+
+		return flags;
+	}
+
+	/// @brief 登録した型のサイズとメンバが C++ の定義と一致しているか調べる
+	/// @return 不一致の内容。一致していれば空
+	template <class State>
+	Array<String> CheckStateType(const asIScriptEngine* engine)
+	{
+		using Traits = StateTraits<State>;
+
+		const String typeName = Unicode::Widen(Traits::Name);
+
+		Array<String> mismatches;
+
+		const asITypeInfo* type = engine->GetTypeInfoByName(std::string{ Traits::Name }.c_str());
+
+		if (type == nullptr)
+		{
+			mismatches.push_back(U"{}: not registered"_fmt(typeName));
+			return mismatches;
+		}
+
+		if (type->GetSize() != sizeof(State))
+		{
+			mismatches.push_back(U"{}: size {} (C++: {})"_fmt(typeName, type->GetSize(), sizeof(State)));
+		}
+
+		if (type->GetPropertyCount() != Traits::Properties.size())
+		{
+			mismatches.push_back(U"{}: {} properties (C++: {})"_fmt(typeName, type->GetPropertyCount(), Traits::Properties.size()));
+			return mismatches;
+		}
+
+		for (asUINT i = 0; i < type->GetPropertyCount(); ++i)
+		{
+			const auto& property = Traits::Properties[i];
+
+			const char* name = nullptr;
+			int typeId = 0;
+			int offset = 0;
+			type->GetProperty(i, &name, &typeId, nullptr, nullptr, &offset);
+
+			const asITypeInfo* propertyType = engine->GetTypeInfoById(typeId);
+			const size_t size = (propertyType ? propertyType->GetSize() : static_cast<size_t>(engine->GetSizeOfPrimitiveType(typeId)));
+
+			if ((name == nullptr) || (property.name != name))
+			{
+				mismatches.push_back(U"{}.{}: registered as {}"_fmt(typeName, Unicode::Widen(property.name), Unicode::Widen(name ? name : "?")));
+			}
+
+			if (static_cast<size_t>(offset) != property.offset)
+			{
+				mismatches.push_back(U"{}.{}: offset {} (C++: {})"_fmt(typeName, Unicode::Widen(property.name), offset, property.offset));
+			}
+
+			if (size != property.size)
+			{
+				mismatches.push_back(U"{}.{}: size {} (C++: {})"_fmt(typeName, Unicode::Widen(property.name), size, property.size));
+			}
+		}
+
+		return mismatches;
+	}
+
+	/// @brief 状態型を1つ登録する
+	/// @return 登録後の検査で見つかった不一致
+	template <class State>
+	Array<String> RegisterStateType(asIScriptEngine* engine)
+	{
+		using Traits = StateTraits<State>;
+
+		static_assert(IsValidStateLayout<State>(), "StateTraits: properties overlap or exceed the type");
+
+		const std::string typeName{ Traits::Name };
+
+		engine->RegisterObjectType(typeName.c_str(), sizeof(State), (asOBJ_VALUE | asOBJ_POD | GetStateAppFlags<State>()));
+
+		for (const auto& property : Traits::Properties)
+		{
+			const std::string decl = (std::string{ property.type } + ' ' + std::string{ property.name });
+			engine->RegisterObjectProperty(typeName.c_str(), decl.c_str(), static_cast<int>(property.offset));
+		}
+
+		return CheckStateType<State>(engine);
+	}
+
+	/// @brief 状態型をまとめて登録する
+	/// @return 登録後の検査で見つかった不一致
+	template <class... States>
+	Array<String> RegisterStateTypes(asIScriptEngine* engine)
+	{
+		Array<String> mismatches;
+
+		(mismatches.append(RegisterStateType<States>(engine)), ...);
+
+		return mismatches;
+	}
+}
@@ -0,0 +1,312 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "CatState.hpp"
+# include "ScriptCoroutine.hpp"
+
+# if SIV3D_PLATFORM(WINDOWS)
+#	include <Siv3D/Windows/Windows.hpp>
+# elif SIV3D_PLATFORM(LINUX) || SIV3D_PLATFORM(MACOS)
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <unistd.h>
+# endif
+
+/// @brief ねこの状態を共有メモリに書き出し、別プロセスのツールから読めるようにする
+///
+/// 共有メモリの名前は、Windows では "Local\\<name>" のファイルマッピング、
+/// それ以外では "/<name>" の POSIX 共有メモリ。
+///
+/// レイアウト (リトルエンディアン、すべて固定長):
+///
+///   [0]   Header (64 バイト)
+///   [64]  Slot × slotCount  (1個 = 32 + entitySize × maxEntities バイト)
+///
+///   Header
+///     +0   uint32  magic        'ASCS' (0x53435341)
+///     +4   uint32  version      Version
+///     +8   uint32  slotCount    リングのスロット数
+///     +12  uint32  maxEntities  1スロットに入るねこの最大数
+///     +16  uint32  slotSize     スロット1個のバイト数
+///     +20  uint32  entitySize   Entity のバイト数
+///     +24  uint64  latestFrame  最後に書き終えたフレーム番号 + 1 (0 なら未書き込み)
+///
+///   Slot (フレーム番号 % slotCount の位置に書く)
+///     +0   uint64  sequence     seqlock。奇数なら書き込み中
+///     +8   uint64  frame        フレーム番号
+///     +16  double  simSeconds   シミュレーション時間(秒)
+///     +24  uint32  count        ねこの数 (maxEntities を超えた分は書かない)
+///     +28  uint32  totalCount   実際のねこの数
+///     +32  Entity  entities[maxEntities]
+///
+///   Entity
+///     +0   double  x
+///     +8   double  y
+///     +16  int32   sprite
+///     +20  uint32  dirty        最後に clearDirty() してから変わったメンバ (CatState の StateTraits の順のビット)
+///
+/// dirty はコルーチンの dirtyProperties() で、メインループは描画フレームの終わりに clearDirty() する。
+/// 書き出しはシミュレーションのステップごとなので、1回の描画フレームで複数のステップを進めた場合、
+/// 後のステップの dirty には同じ描画フレームの前のステップで変わったメンバも含まれる (前のステップからの差分ではない)。
+///
+/// 読む側はスロットの sequence を読み、偶数ならデータを読み、もう一度 sequence を読んで同じ値なら有効とする。
+/// 書く側は読む側を待たないので、slotCount フレーム以上遅れた読み手はフレームを取りこぼす。
+class StateExport
+{
+public:
+	static constexpr uint32 Magic = 0x53435341;
+
+	static constexpr uint32 Version = 1;
+
+	struct Header
+	{
+		uint32 magic;
+
+		uint32 version;
+
+		uint32 slotCount;
+
+		uint32 maxEntities;
+
+		uint32 slotSize;
+
+		uint32 entitySize;
+
+		uint64 latestFrame;
+
+		uint8 reserved[32];
+	};
+
+	struct SlotHeader
+	{
+		uint64 sequence;
+
+		uint64 frame;
+
+		double simSeconds;
+
+		uint32 count;
+
+		uint32 totalCount;
+	};
+
+	struct Entity
+	{
+		double x;
+
+		double y;
+
+		int32 sprite;
+
+		/// @brief 最後に clearDirty() してから変わったメンバ (前のステップからの差分ではない)
+		uint32 dirty;
+	};
+
+	static_assert(sizeof(Header) == 64);
+	static_assert(offsetof(Header, latestFrame) == 24);
+	static_assert(sizeof(SlotHeader) == 32);
+	static_assert(sizeof(Entity) == 24);
+	static_assert(std::atomic_ref<uint64>::is_always_lock_free);
+
+	/// @param name 共有メモリの名前
+	/// @param slotCount リングのスロット数
+	/// @param maxEntities 1フレームに書くねこの最大数
+	StateExport(StringView name, uint32 slotCount = 8, uint32 maxEntities = 65536)
+		: slotCount_{ Max<uint32>(slotCount, 1) }
+		, maxEntities_{ maxEntities }
+		, slotSize_{ static_cast<uint32>(sizeof(SlotHeader) + (sizeof(Entity) * maxEntities)) }
+		, size_{ sizeof(Header) + (static_cast<size_t>(slotSize_) * slotCount_) }
+	{
+		if (not open_(name))
+		{
+			return;
+		}
+
+		Header* header = this->header();
+		std::memset(data_, 0, size_);
+		header->magic = Magic;
+		header->version = Version;
+		header->slotCount = slotCount_;
+		header->maxEntities = maxEntities_;
+		header->slotSize = slotSize_;
+		header->entitySize = sizeof(Entity);
+	}
+
+	StateExport(const StateExport&) = delete;
+
+	StateExport& operator =(const StateExport&) = delete;
+
+	~StateExport()
+	{
+		close_();
+	}
+
+	/// @brief 共有メモリを作成できたか
+	bool isOpen() const
+	{
+		return (data_ != nullptr);
+	}
+
+	/// @brief 1フレーム分の状態を書き出す
+	/// @param frame フレーム番号
+	/// @param simSeconds シミュレーション時間(秒)
+	/// @param coroutines ねこのコルーチン
+	template <class CoroPtrArray>
+	void publish(uint64 frame, double simSeconds, const CoroPtrArray& coroutines)
+	{
+		if (not isOpen())
+		{
+			return;
+		}
+
+		Byte* slot = (data_ + sizeof(Header) + (static_cast<size_t>(slotSize_) * (frame % slotCount_)));
+		SlotHeader* slotHeader = reinterpret_cast<SlotHeader*>(slot);
+		std::atomic_ref<uint64> sequence{ slotHeader->sequence };
+
+		const uint64 seq = sequence.load(std::memory_order_relaxed);
+		sequence.store((seq + 1), std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		Entity* entities = reinterpret_cast<Entity*>(slot + sizeof(SlotHeader));
+		uint32 count = 0;
+
+		for (const auto& coro : coroutines)
+		{
+			if (maxEntities_ <= count)
+			{
+				break;
+			}
+
+			const CatState& state = coro->getState();
+			entities[count++] = Entity{ state.pos.x, state.pos.y, state.sprite, coro->dirtyProperties() };
+		}
+
+		slotHeader->frame = frame;
+		slotHeader->simSeconds = simSeconds;
+		slotHeader->count = count;
+		slotHeader->totalCount = static_cast<uint32>(coroutines.size());
+
+		sequence.store((seq + 2), std::memory_order_release);
+		std::atomic_ref<uint64>{ header()->latestFrame }.store((frame + 1), std::memory_order_release);
+	}
+
+private:
+	uint32 slotCount_;
+
+	uint32 maxEntities_;
+
+	uint32 slotSize_;
+
+	size_t size_;
+
+	Byte* data_ = nullptr;
+
+# if SIV3D_PLATFORM(WINDOWS)
+
+	HANDLE mapping_ = nullptr;
+
+# else
+
+	std::string name_;
+
+# endif
+
+	Header* header()
+	{
+		return reinterpret_cast<Header*>(data_);
+	}
+
+	bool open_(StringView name)
+	{
+	# if SIV3D_PLATFORM(WINDOWS)
+
+		const std::wstring mappingName = (U"Local\\" + String{ name }).toWstr();
+
+		mapping_ = ::CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(static_cast<uint64>(size_) >> 32), static_cast<DWORD>(size_), mappingName.c_str());
+
+		if (mapping_ == nullptr)
+		{
+			return false;
+		}
+
+		data_ = static_cast<Byte*>(::MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, size_));
+
+		if (data_ == nullptr)
+		{
+			close_();
+			return false;
+		}
+
+		return true;
+
+	# elif SIV3D_PLATFORM(LINUX) || SIV3D_PLATFORM(MACOS)
+
+		name_ = ("/" + name.narrow());
+
+		const int fd = ::shm_open(name_.c_str(), (O_CREAT | O_RDWR), 0644);
+
+		if (fd == -1)
+		{
+			name_.clear();
+			return false;
+		}
+
+		void* p = MAP_FAILED;
+
+		if (::ftruncate(fd, static_cast<off_t>(size_)) == 0)
+		{
+			p = ::mmap(nullptr, size_, (PROT_READ | PROT_WRITE), MAP_SHARED, fd, 0);
+		}
+
+		::close(fd);
+
+		if (p == MAP_FAILED)
+		{
+			close_();
+			return false;
+		}
+
+		data_ = static_cast<Byte*>(p);
+
+		return true;
+
+	# else
+
+		return false;
+
+	# endif
+	}
+
+	void close_()
+	{
+	# if SIV3D_PLATFORM(WINDOWS)
+
+		if (data_)
+		{
+			::UnmapViewOfFile(data_);
+		}
+
+		if (mapping_)
+		{
+			::CloseHandle(mapping_);
+			mapping_ = nullptr;
+		}
+
+	# elif SIV3D_PLATFORM(LINUX) || SIV3D_PLATFORM(MACOS)
+
+		if (data_)
+		{
+			::munmap(data_, size_);
+		}
+
+		if (not name_.empty())
+		{
+			::shm_unlink(name_.c_str());
+			name_.clear();
+		}
+
+	# endif
+
+		data_ = nullptr;
+	}
+};
@@ -0,0 +1,217 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+
+# if SIV3D_PLATFORM(WINDOWS)
+#	include <Siv3D/Windows/Windows.hpp>
+# elif SIV3D_PLATFORM(LINUX)
+#	include <fstream>
+#	include <pthread.h>
+#	include <sched.h>
+# endif
+
+namespace ThreadAffinity
+{
+	/// @brief 論理コアの数
+	inline size_t LogicalCoreCount()
+	{
+		return Max<size_t>(std::thread::hardware_concurrency(), 1);
+	}
+
+	/// @brief 現在のスレッドを論理コアに固定する
+	/// @param core 論理コアの番号 (LogicalCoreCount() 以上の場合は折り返す)
+	/// @return 固定できた場合 true
+	inline bool PinCurrentThread(size_t core)
+	{
+		core %= LogicalCoreCount();
+
+	# if SIV3D_PLATFORM(WINDOWS)
+
+		if (core >= (sizeof(DWORD_PTR) * 8))
+		{
+			return false;
+		}
+
+		return (::SetThreadAffinityMask(::GetCurrentThread(), (DWORD_PTR{ 1 } << core)) != 0);
+
+	# elif SIV3D_PLATFORM(LINUX)
+
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		CPU_SET(core, &cpuSet);
+
+		return (::pthread_setaffinity_np(::pthread_self(), sizeof(cpuSet), &cpuSet) == 0);
+
+	# else
+
+		return false;
+
+	# endif
+	}
+
+	/// @brief 論理コア1つ分の配置
+	struct LogicalCpu
+	{
+		/// @brief 論理コアの番号
+		size_t cpu = 0;
+
+		/// @brief 物理パッケージ (ソケット) の番号
+		size_t package = 0;
+
+		/// @brief 物理コアの番号 (パッケージをまたいで一意)
+		size_t core = 0;
+
+		/// @brief L2 キャッシュを共有する論理コアの組 (組の中で最小の論理コアの番号)
+		size_t l2Group = 0;
+
+		/// @brief L3 キャッシュを共有する論理コアの組 (組の中で最小の論理コアの番号)
+		size_t l3Group = 0;
+
+		/// @brief 物理コアの最初の論理コアか (SMT の兄弟では1つだけが true)
+		bool primary = true;
+	};
+
+	/// @brief ワーカースレッドを論理コアに固定する方針
+	enum class PinPolicy : uint8
+	{
+		/// @brief 固定しない
+		None,
+
+		/// @brief 物理コアごとに1スレッド (SMT の兄弟は使わない)
+		PhysicalCores,
+
+		/// @brief 論理コアごとに1スレッド (SMT の兄弟を隣り合わせに使う)
+		LogicalCores,
+	};
+
+	/// @brief "none", "cores", "logical" を PinPolicy にする
+	inline Optional<PinPolicy> ParsePinPolicy(StringView name)
+	{
+		if (name == U"none")
+		{
+			return PinPolicy::None;
+		}
+		else if (name == U"cores")
+		{
+			return PinPolicy::PhysicalCores;
+		}
+		else if (name == U"logical")
+		{
+			return PinPolicy::LogicalCores;
+		}
+
+		return none;
+	}
+
+	namespace detail
+	{
+	# if SIV3D_PLATFORM(LINUX)
+
+		/// @brief sysfs のファイルの先頭の数 ("0-3,8-11" のような一覧なら最初の番号)
+		inline Optional<size_t> ReadFirstNumber(const std::string& path)
+		{
+			std::ifstream ifs{ path };
+			size_t value = 0;
+
+			if (ifs >> value)
+			{
+				return value;
+			}
+
+			return none;
+		}
+
+	# endif
+	}
+
+	/// @brief 論理コアの配置を読む
+	/// @remark Linux では sysfs (/sys/devices/system/cpu) から読む。
+	/// 読めない場合や他の環境では、各論理コアを別の物理コアとし、キャッシュはすべて共有とみなす
+	inline Array<LogicalCpu> ReadTopology()
+	{
+		Array<LogicalCpu> cpus;
+
+		for (size_t cpu = 0; cpu < LogicalCoreCount(); ++cpu)
+		{
+			LogicalCpu info{ .cpu = cpu, .core = cpu, .l2Group = cpu, .l3Group = 0 };
+
+		# if SIV3D_PLATFORM(LINUX)
+
+			const std::string base = ("/sys/devices/system/cpu/cpu" + std::to_string(cpu));
+
+			if (const auto package = detail::ReadFirstNumber(base + "/topology/physical_package_id"))
+			{
+				info.package = *package;
+				info.l3Group = *package;
+			}
+
+			if (const auto coreId = detail::ReadFirstNumber(base + "/topology/core_id"))
+			{
+				// core_id はパッケージ内でしか一意でない
+				info.core = ((info.package << 16) | *coreId);
+			}
+
+			for (size_t index = 0;; ++index)
+			{
+				const std::string cache = (base + "/cache/index" + std::to_string(index));
+				const auto level = detail::ReadFirstNumber(cache + "/level");
+
+				if (not level)
+				{
+					break;
+				}
+
+				if (const auto group = detail::ReadFirstNumber(cache + "/shared_cpu_list"))
+				{
+					if (*level == 2)
+					{
+						info.l2Group = *group;
+					}
+					else if (*level == 3)
+					{
+						info.l3Group = *group;
+					}
+				}
+			}
+
+		# endif
+
+			info.primary = cpus.none([&](const LogicalCpu& other) { return (other.core == info.core); });
+
+			cpus.push_back(info);
+		}
+
+		return cpus;
+	}
+
+	/// @brief ワーカースレッドを固定する論理コアを選ぶ
+	///
+	/// キャッシュを共有するコアが隣り合うように (L3、L2、物理コアの順に) 並べ、先頭から count 個を選ぶ。
+	/// コアが足りなければ先頭に戻る。
+	/// @return i 番目のワーカースレッドを固定する論理コア。PinPolicy::None なら空
+	inline Array<LogicalCpu> SelectCpus(Array<LogicalCpu> topology, PinPolicy policy, size_t count)
+	{
+		if (policy == PinPolicy::None)
+		{
+			return{};
+		}
+
+		if (policy == PinPolicy::PhysicalCores)
+		{
+			topology.remove_if([](const LogicalCpu& cpu) { return (not cpu.primary); });
+		}
+
+		topology.stable_sort_by([](const LogicalCpu& a, const LogicalCpu& b)
+			{
+				return (std::tie(a.l3Group, a.l2Group, a.core, a.cpu) < std::tie(b.l3Group, b.l2Group, b.core, b.cpu));
+			});
+
+		Array<LogicalCpu> selected;
+
+		for (size_t i = 0; (i < count) && (not topology.isEmpty()); ++i)
+		{
+			selected.push_back(topology[i % topology.size()]);
+		}
+
+		return selected;
+	}
+}
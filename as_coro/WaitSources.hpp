@@ -0,0 +1,407 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "ScriptCoroutine.hpp"
+
+namespace s3d
+{
+	class WaitSet;
+
+	class WaitSource;
+
+	/// @brief 待機の元 (Event, Channel) と WaitSet の、内部の登録ひとつ分
+	///
+	/// 待機の元ごとの双方向リストにつなぐので、どの元からも O(1) で外せる。
+	struct WaitNode
+	{
+		WaitNode* prev = nullptr;
+
+		WaitNode* next = nullptr;
+
+		WaitSource* source = nullptr;
+
+		WaitSet* set = nullptr;
+
+		/// @brief WaitSet 内の番号 (WaitSet::add() の戻り値)
+		int32 index = 0;
+	};
+
+	/// @brief Select() で待てるもの
+	///
+	/// スクリプトの参照型として登録するので、参照カウントで寿命を管理する。
+	class WaitSource
+	{
+	public:
+		WaitSource(const WaitSource&) = delete;
+
+		WaitSource& operator =(const WaitSource&) = delete;
+
+		void addRef()
+		{
+			++refCount_;
+		}
+
+		void release()
+		{
+			if (--refCount_ == 0)
+			{
+				delete this;
+			}
+		}
+
+	protected:
+		WaitSource() = default;
+
+		virtual ~WaitSource() = default;
+
+		/// @brief 今 Select() したらすぐに終わるか
+		/// @remark WaitMutex() を持って呼ぶ
+		virtual bool isReady_() const = 0;
+
+		/// @brief 待っている WaitSet を1つ起こす (先に登録したものから)
+		/// @remark WaitMutex() を持って呼ぶ
+		void wakeOne_();
+
+		/// @brief 待っている WaitSet をすべて起こす
+		/// @remark WaitMutex() を持って呼ぶ
+		void wakeAll_();
+
+	private:
+		friend class WaitSet;
+
+		std::atomic<int32> refCount_ = 1;
+
+		WaitNode* head_ = nullptr;
+
+		WaitNode* tail_ = nullptr;
+
+		void link_(WaitNode& node)
+		{
+			node.prev = tail_;
+			node.next = nullptr;
+			(tail_ ? tail_->next : head_) = &node;
+			tail_ = &node;
+		}
+
+		void unlink_(WaitNode& node)
+		{
+			(node.prev ? node.prev->next : head_) = node.next;
+			(node.next ? node.next->prev : tail_) = node.prev;
+			node.prev = node.next = nullptr;
+		}
+	};
+
+	/// @brief スクリプトの Event
+	///
+	/// signal() すると、reset() するまでシグナル状態のままになる。
+	/// シグナル状態になったとき、待っているすべてのコルーチンを起こす。
+	class ScriptEvent final : public WaitSource
+	{
+	public:
+		static ScriptEvent* Create()
+		{
+			return new ScriptEvent;
+		}
+
+		void signal()
+		{
+			std::lock_guard lock{ WaitMutex() };
+			signaled_ = true;
+			wakeAll_();
+		}
+
+		void reset()
+		{
+			std::lock_guard lock{ WaitMutex() };
+			signaled_ = false;
+		}
+
+		bool isSignaled() const
+		{
+			std::lock_guard lock{ WaitMutex() };
+			return signaled_;
+		}
+
+	private:
+		bool signaled_ = false;
+
+		bool isReady_() const override
+		{
+			return signaled_;
+		}
+	};
+
+	/// @brief スクリプトの Channel (int の FIFO、上限なし)
+	///
+	/// send() するたびに、待っているコルーチンを1つ起こす。
+	/// 起きたコルーチンは tryReceive() で値を取り出す (Select() は値を取り出さない)。
+	class ScriptChannel final : public WaitSource
+	{
+	public:
+		static ScriptChannel* Create()
+		{
+			return new ScriptChannel;
+		}
+
+		void send(int32 value)
+		{
+			std::lock_guard lock{ WaitMutex() };
+			values_.push_back(value);
+			wakeOne_();
+		}
+
+		/// @brief 値があれば先頭を取り出す
+		/// @return 取り出せたら true
+		bool tryReceive(int32& value)
+		{
+			std::lock_guard lock{ WaitMutex() };
+
+			if (values_.empty())
+			{
+				return false;
+			}
+
+			value = values_.front();
+			values_.pop_front();
+			return true;
+		}
+
+		uint32 size() const
+		{
+			std::lock_guard lock{ WaitMutex() };
+			return static_cast<uint32>(values_.size());
+		}
+
+	private:
+		std::deque<int32> values_;
+
+		bool isReady_() const override
+		{
+			return (not values_.empty());
+		}
+	};
+
+	/// @brief Select() で同時に待つ Event と Channel の組
+	///
+	/// Select() で待機を始めると、組のすべての元に登録する。
+	/// 最初に起きた元の番号を fired() に記録し、ほかの元からの登録はその場で外す。
+	/// タイムアウトした場合やコルーチンが破棄された場合も、再開・破棄の前に登録を外す。
+	class WaitSet final : public ISelectWait
+	{
+	public:
+		static WaitSet* Create()
+		{
+			return new WaitSet;
+		}
+
+		WaitSet(const WaitSet&) = delete;
+
+		WaitSet& operator =(const WaitSet&) = delete;
+
+		void addRef()
+		{
+			++refCount_;
+		}
+
+		void release()
+		{
+			if (--refCount_ == 0)
+			{
+				delete this;
+			}
+		}
+
+		/// @brief 待つ元を追加する
+		/// @param source 追加する元。参照を受け取る
+		/// @return 組の中の番号 (追加した順に 0, 1, ...)。待機中か source が null の場合は -1
+		int32 add(WaitSource* source)
+		{
+			if (source == nullptr)
+			{
+				return -1;
+			}
+
+			std::lock_guard lock{ WaitMutex() };
+
+			if (waiter_)
+			{
+				source->release();
+				return -1;
+			}
+
+			const int32 index = static_cast<int32>(nodes_.size());
+			nodes_.push_back({ .source = source, .set = this, .index = index });
+			return index;
+		}
+
+		/// @brief 直前の Select() で起きた元の番号
+		/// @return タイムアウトした場合と、まだ待機中の場合は -1
+		int32 fired() const
+		{
+			std::lock_guard lock{ WaitMutex() };
+			return fired_;
+		}
+
+		/// @brief コルーチンを待機させる
+		/// @param timeoutWakeTime タイムアウトで再開する時刻 (時計のマイクロ秒)。待機する場合だけ waiter.wakeTime に設定する
+		/// @return すでに条件を満たした元があり、待機しなかった場合 true (fired() はその元)
+		/// @remark 元に登録した直後から別のスレッドが fire_() で wakeTime を書き換えうるので、タイムアウトも同じロックの中で設定する
+		bool arm(CoroutineRecord& waiter, uint64 timeoutWakeTime)
+		{
+			std::lock_guard lock{ WaitMutex() };
+
+			cancel_();
+			fired_ = -1;
+
+			for (const auto& node : nodes_)
+			{
+				if (node.source->isReady_())
+				{
+					fired_ = node.index;
+					return true;
+				}
+			}
+
+			waiter.wakeTime = timeoutWakeTime;
+
+			for (auto& node : nodes_)
+			{
+				node.source->link_(node);
+			}
+
+			waiter_ = &waiter;
+			waiter.select = this;
+			return false;
+		}
+
+		/// @brief 待機をやめ、すべての元から登録を外す
+		void cancel()
+		{
+			std::lock_guard lock{ WaitMutex() };
+			cancel_();
+		}
+
+		void cancelLocked() override
+		{
+			cancel_();
+		}
+
+		void rebindLocked(CoroutineRecord& waiter) override
+		{
+			if (waiter_)
+			{
+				waiter_ = &waiter;
+			}
+		}
+
+	private:
+		friend class WaitSource;
+
+		std::atomic<int32> refCount_ = 1;
+
+		Array<WaitNode> nodes_;
+
+		/// @brief 待機中のコルーチンの記録。待機していなければ nullptr
+		CoroutineRecord* waiter_ = nullptr;
+
+		int32 fired_ = -1;
+
+		WaitSet() = default;
+
+		~WaitSet()
+		{
+			cancel();
+
+			for (auto& node : nodes_)
+			{
+				node.source->release();
+			}
+		}
+
+		/// @remark WaitMutex() を持って呼ぶ
+		void cancel_()
+		{
+			if (waiter_ == nullptr)
+			{
+				return;
+			}
+
+			for (auto& node : nodes_)
+			{
+				node.source->unlink_(node);
+			}
+
+			waiter_->select = nullptr;
+			waiter_ = nullptr;
+		}
+
+		/// @brief index の元が起きたので、コルーチンを次の resumeAll() で再開させる
+		/// @remark WaitMutex() を持って呼ぶ
+		void fire_(int32 index)
+		{
+			CoroutineRecord& waiter = *waiter_;
+
+			cancel_();
+			fired_ = index;
+
+			waiter.wakeTime = ISteadyClock::GetMicrosec(waiter.clock);
+
+			if (waiter.wakeNotify)
+			{
+				waiter.wakeNotify->store(true);
+			}
+		}
+	};
+
+	inline void WaitSource::wakeOne_()
+	{
+		if (head_)
+		{
+			head_->set->fire_(head_->index);
+		}
+	}
+
+	inline void WaitSource::wakeAll_()
+	{
+		// fire_() が WaitSet のすべての登録を外すので、先頭が空になるまで続ける
+		while (head_)
+		{
+			head_->set->fire_(head_->index);
+		}
+	}
+}
+
+namespace Scripting
+{
+	using namespace AngelScript;
+
+	namespace Binding
+	{
+		/// @brief Event, Channel, WaitSet を登録する
+		inline void RegisterWaitTypes(asIScriptEngine* engine)
+		{
+			engine->RegisterObjectType("Event", 0, asOBJ_REF);
+			engine->RegisterObjectBehaviour("Event", asBEHAVE_FACTORY, "Event@ f()", asFUNCTION(ScriptEvent::Create), asCALL_CDECL);
+			engine->RegisterObjectBehaviour("Event", asBEHAVE_ADDREF, "void f()", asMETHOD(ScriptEvent, addRef), asCALL_THISCALL);
+			engine->RegisterObjectBehaviour("Event", asBEHAVE_RELEASE, "void f()", asMETHOD(ScriptEvent, release), asCALL_THISCALL);
+			engine->RegisterObjectMethod("Event", "void signal()", asMETHOD(ScriptEvent, signal), asCALL_THISCALL);
+			engine->RegisterObjectMethod("Event", "void reset()", asMETHOD(ScriptEvent, reset), asCALL_THISCALL);
+			engine->RegisterObjectMethod("Event", "bool get_signaled() const property", asMETHOD(ScriptEvent, isSignaled), asCALL_THISCALL);
+
+			engine->RegisterObjectType("Channel", 0, asOBJ_REF);
+			engine->RegisterObjectBehaviour("Channel", asBEHAVE_FACTORY, "Channel@ f()", asFUNCTION(ScriptChannel::Create), asCALL_CDECL);
+			engine->RegisterObjectBehaviour("Channel", asBEHAVE_ADDREF, "void f()", asMETHOD(ScriptChannel, addRef), asCALL_THISCALL);
+			engine->RegisterObjectBehaviour("Channel", asBEHAVE_RELEASE, "void f()", asMETHOD(ScriptChannel, release), asCALL_THISCALL);
+			engine->RegisterObjectMethod("Channel", "void send(int)", asMETHOD(ScriptChannel, send), asCALL_THISCALL);
+			engine->RegisterObjectMethod("Channel", "bool tryReceive(int &out)", asMETHOD(ScriptChannel, tryReceive), asCALL_THISCALL);
+			engine->RegisterObjectMethod("Channel", "uint get_size() const property", asMETHOD(ScriptChannel, size), asCALL_THISCALL);
+
+			engine->RegisterObjectType("WaitSet", 0, asOBJ_REF);
+			engine->RegisterObjectBehaviour("WaitSet", asBEHAVE_FACTORY, "WaitSet@ f()", asFUNCTION(WaitSet::Create), asCALL_CDECL);
+			engine->RegisterObjectBehaviour("WaitSet", asBEHAVE_ADDREF, "void f()", asMETHOD(WaitSet, addRef), asCALL_THISCALL);
+			engine->RegisterObjectBehaviour("WaitSet", asBEHAVE_RELEASE, "void f()", asMETHOD(WaitSet, release), asCALL_THISCALL);
+			engine->RegisterObjectMethod("WaitSet", "int add(Event@)", asMETHODPR(WaitSet, add, (WaitSource*), int32), asCALL_THISCALL);
+			engine->RegisterObjectMethod("WaitSet", "int add(Channel@)", asMETHODPR(WaitSet, add, (WaitSource*), int32), asCALL_THISCALL);
+			engine->RegisterObjectMethod("WaitSet", "int get_fired() const property", asMETHOD(WaitSet, fired), asCALL_THISCALL);
+		}
+	}
+}
@@ -0,0 +1,296 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "ThreadAffinity.hpp"
+
+/// @brief ワーカースレッド1つ分の稼働状況
+struct WorkerUtilization
+{
+	/// @brief 固定した論理コア。固定していなければ none
+	Optional<size_t> cpu;
+
+	/// @brief 処理を実行していた時間(秒)
+	double busySeconds = 0.0;
+
+	/// @brief 実行した処理の数
+	uint64 items = 0;
+
+	/// @brief 計測期間のうち処理を実行していた割合
+	double utilization = 0.0;
+};
+
+/// @brief コルーチンを並列に再開するためのワーカースレッド
+///
+/// parallelFor() を呼んだスレッドも処理に加わり、すべて終わるまで戻らない。
+/// スクリプトを実行するので、各スレッドは終了時に asThreadCleanup() を呼ぶ。
+///
+/// ワーカースレッドを論理コアに固定した場合は、L3 キャッシュを共有するスレッドを組にし、
+/// 処理の範囲を組ごとの連続した区間に分ける。各スレッドは自分の組の区間を終えてから、ほかの組の残りを手伝う。
+class WorkerPool
+{
+public:
+	/// @param threadCount ワーカースレッドの数 (呼び出し側のスレッドは含まない)
+	/// @param pin ワーカースレッドを論理コアに固定する方針。呼び出し側のスレッドは固定しない
+	explicit WorkerPool(size_t threadCount, ThreadAffinity::PinPolicy pin = ThreadAffinity::PinPolicy::None)
+		: cpus_{ ThreadAffinity::SelectCpus(ThreadAffinity::ReadTopology(), pin, threadCount) }
+		, threadStats_{ std::make_unique<ThreadStats_[]>(threadCount + 1) }
+		, threadGroup_(threadCount + 1, 0)
+	{
+		// 呼び出し側のスレッドは最初の組に入れる
+		Array<size_t> groupKeys;
+
+		for (size_t i = 0; i < cpus_.size(); ++i)
+		{
+			const size_t key = cpus_[i].l3Group;
+			const auto it = std::find(groupKeys.begin(), groupKeys.end(), key);
+			threadGroup_[i + 1] = static_cast<size_t>(it - groupKeys.begin());
+
+			if (it == groupKeys.end())
+			{
+				groupKeys.push_back(key);
+			}
+		}
+
+		groupCount_ = Max<size_t>(groupKeys.size(), 1);
+		groups_ = std::make_unique<Group_[]>(groupCount_);
+
+		for (const size_t group : threadGroup_)
+		{
+			++groups_[group].threadCount;
+		}
+
+		// 複数のスレッドからエンジンを使う前に、メインスレッドで呼ぶ
+		AngelScript::asPrepareMultithread();
+
+		for (size_t i = 0; i < threadCount; ++i)
+		{
+			threads_.emplace_back([this, i] { workerMain_(i + 1); });
+		}
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+
+	WorkerPool& operator =(const WorkerPool&) = delete;
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard lock{ mutex_ };
+			stop_ = true;
+		}
+
+		wakeCondition_.notify_all();
+
+		for (auto& thread : threads_)
+		{
+			thread.join();
+		}
+	}
+
+	/// @brief ワーカースレッドの数
+	size_t size() const
+	{
+		return threads_.size();
+	}
+
+	/// @brief キャッシュを共有するスレッドの組の数
+	size_t groupCount() const
+	{
+		return groupCount_;
+	}
+
+	/// @brief 現在のスレッドの番号
+	/// @return ワーカースレッドなら 1 ... size()。それ以外 (parallelFor() を呼んだスレッド) は 0
+	static size_t CurrentThreadIndex()
+	{
+		return ThreadIndex_;
+	}
+
+	/// @brief f(0) ... f(count - 1) を並列に呼ぶ
+	/// @remark 呼び出しは入れ子にできない
+	void parallelFor(size_t count, const std::function<void(size_t)>& f)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+
+		{
+			std::lock_guard lock{ mutex_ };
+			job_ = &f;
+
+			// 組のスレッド数に比例した連続区間に分ける
+			const size_t totalThreads = (threads_.size() + 1);
+			size_t begin = 0;
+
+			for (size_t g = 0; g < groupCount_; ++g)
+			{
+				const size_t end = ((g + 1 == groupCount_) ? count : (begin + (count * groups_[g].threadCount / totalThreads)));
+				groups_[g].next = begin;
+				groups_[g].end = end;
+				begin = end;
+			}
+
+			active_ = threads_.size();
+			++generation_;
+		}
+
+		wakeCondition_.notify_all();
+
+		runJob_(f, 0);
+
+		std::unique_lock lock{ mutex_ };
+		doneCondition_.wait(lock, [this] { return (active_ == 0); });
+		job_ = nullptr;
+	}
+
+	/// @brief スレッドごとの稼働状況
+	/// @return 0 番目は parallelFor() を呼んだスレッド、続いてワーカースレッドの順
+	Array<WorkerUtilization> utilization() const
+	{
+		const double wallSeconds = sinceReset_.sF();
+
+		Array<WorkerUtilization> result;
+
+		for (size_t i = 0; i < (threads_.size() + 1); ++i)
+		{
+			const double busySeconds = (threadStats_[i].busyNanoseconds.load() / 1e9);
+
+			result.push_back({
+				.cpu = (((0 < i) && (i <= cpus_.size())) ? Optional<size_t>{ cpus_[i - 1].cpu } : none),
+				.busySeconds = busySeconds,
+				.items = threadStats_[i].items.load(),
+				.utilization = ((0.0 < wallSeconds) ? (busySeconds / wallSeconds) : 0.0),
+			});
+		}
+
+		return result;
+	}
+
+	void resetUtilization()
+	{
+		for (size_t i = 0; i < (threads_.size() + 1); ++i)
+		{
+			threadStats_[i].busyNanoseconds = 0;
+			threadStats_[i].items = 0;
+		}
+
+		sinceReset_.restart();
+	}
+
+private:
+	/// @brief スレッドごとの計測値 (ほかのスレッドの値と同じキャッシュラインに載せない)
+	struct alignas(64) ThreadStats_
+	{
+		std::atomic<uint64> busyNanoseconds = 0;
+
+		std::atomic<uint64> items = 0;
+	};
+
+	/// @brief キャッシュを共有するスレッドの組と、その組が受け持つ区間
+	struct alignas(64) Group_
+	{
+		std::atomic<size_t> next = 0;
+
+		size_t end = 0;
+
+		size_t threadCount = 0;
+	};
+
+	/// @brief i 番目のワーカースレッドを固定する論理コア
+	Array<ThreadAffinity::LogicalCpu> cpus_;
+
+	std::unique_ptr<ThreadStats_[]> threadStats_;
+
+	/// @brief [CurrentThreadIndex()] の組
+	Array<size_t> threadGroup_;
+
+	std::unique_ptr<Group_[]> groups_;
+
+	size_t groupCount_ = 1;
+
+	Stopwatch sinceReset_{ StartImmediately::Yes };
+
+	Array<std::thread> threads_;
+
+	std::mutex mutex_;
+
+	std::condition_variable wakeCondition_;
+
+	std::condition_variable doneCondition_;
+
+	const std::function<void(size_t)>* job_ = nullptr;
+
+	/// @brief 現在のジョブをまだ終えていないワーカースレッドの数
+	size_t active_ = 0;
+
+	/// @brief ジョブを開始するたびに増やす
+	uint64 generation_ = 0;
+
+	bool stop_ = false;
+
+	inline static thread_local size_t ThreadIndex_ = 0;
+
+	void runJob_(const std::function<void(size_t)>& f, size_t threadIndex)
+	{
+		const uint64 start = Time::GetNanosec();
+		uint64 items = 0;
+
+		const size_t home = threadGroup_[threadIndex];
+
+		for (size_t k = 0; k < groupCount_; ++k)
+		{
+			Group_& group = groups_[(home + k) % groupCount_];
+
+			for (size_t i = group.next++; i < group.end; i = group.next++)
+			{
+				f(i);
+				++items;
+			}
+		}
+
+		ThreadStats_& stats = threadStats_[threadIndex];
+		stats.busyNanoseconds += (Time::GetNanosec() - start);
+		stats.items += items;
+	}
+
+	void workerMain_(size_t threadIndex)
+	{
+		ThreadIndex_ = threadIndex;
+
+		if (threadIndex <= cpus_.size())
+		{
+			ThreadAffinity::PinCurrentThread(cpus_[threadIndex - 1].cpu);
+		}
+
+		uint64 seenGeneration = 0;
+
+		for (;;)
+		{
+			const std::function<void(size_t)>* job = nullptr;
+			{
+				std::unique_lock lock{ mutex_ };
+				wakeCondition_.wait(lock, [&] { return (stop_ || (seenGeneration != generation_)); });
+
+				if (stop_)
+				{
+					break;
+				}
+
+				seenGeneration = generation_;
+				job = job_;
+			}
+
+			runJob_(*job, threadIndex);
+
+			{
+				std::lock_guard lock{ mutex_ };
+				--active_;
+			}
+
+			doneCondition_.notify_one();
+		}
+
+		// AngelScript がこのスレッド用に確保したメモリを解放する
+		AngelScript::asThreadCleanup();
+	}
+};
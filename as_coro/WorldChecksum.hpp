@@ -0,0 +1,334 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "CoroutineScheduler.hpp"
+
+/// @brief フレームごとのシミュレーション全体のハッシュ値を記録・比較し、実行結果が一致するか調べる
+///
+/// 並列化などで実行方法を変えたときに、1スレッドのインタプリタと同じ結果になるかの確認に使う。
+/// 状態は StateTraits のメンバだけを HashState() でハッシュするので、パディングやポインタには左右されない。
+/// スタックを含める場合は、スコープ内のプリミティブ型の変数と、値型の変数のプリミティブ型のメンバを使う
+/// (ハンドルや参照型の中身は含めない)。
+///
+/// ファイルの形式 (リトルエンディアン):
+///   Header: uint32 magic 'ASCK', uint32 version, uint32 includeStacks, uint64 seed
+///   Frame:  uint64 frame, uint64 hash, uint32 count, CoroutineHash × count (uint64 id, uint64 hash)
+namespace WorldChecksum
+{
+	inline constexpr uint32 Magic = 0x4B435341;
+
+	inline constexpr uint32 Version = 2;
+
+	/// @brief コルーチン1個分のハッシュ値
+	struct CoroutineHash
+	{
+		/// @brief CoroutineRecord::id
+		uint64 id = 0;
+
+		uint64 hash = 0;
+	};
+
+	/// @brief 1フレーム分のハッシュ値
+	struct Frame
+	{
+		uint64 frame = 0;
+
+		/// @brief 時計とすべてのコルーチンのハッシュ値をまとめたもの
+		uint64 hash = 0;
+
+		/// @brief 実行リストの順のコルーチンのハッシュ値
+		Array<CoroutineHash> coroutines;
+	};
+
+	/// @brief 中断中の Context のスタック上の変数のハッシュ値
+	inline uint64 HashStack(asIScriptContext* ctx, uint64 seed)
+	{
+		if ((ctx == nullptr) || (ctx->GetState() != asEXECUTION_SUSPENDED))
+		{
+			return seed;
+		}
+
+		asIScriptEngine* engine = ctx->GetEngine();
+
+		const asUINT levels = ctx->GetCallstackSize();
+
+		for (asUINT level = 0; level < levels; ++level)
+		{
+			const int line = ctx->GetLineNumber(level);
+			seed = Scripting::HashBytes(&line, sizeof(line), seed);
+
+			for (int var = 0; var < ctx->GetVarCount(level); ++var)
+			{
+				if (not ctx->IsVarInScope(var, level))
+				{
+					continue;
+				}
+
+				int typeId = 0;
+				ctx->GetVar(var, level, nullptr, &typeId);
+
+				const Byte* p = static_cast<const Byte*>(ctx->GetAddressOfVar(var, level));
+
+				if ((p == nullptr) || (typeId & asTYPEID_OBJHANDLE))
+				{
+					continue;
+				}
+
+				if (not (typeId & asTYPEID_MASK_OBJECT))
+				{
+					seed = Scripting::HashBytes(p, static_cast<size_t>(Max(engine->GetSizeOfPrimitiveType(typeId), 0)), seed);
+					continue;
+				}
+
+				const asITypeInfo* type = engine->GetTypeInfoById(typeId);
+
+				if ((type == nullptr) || (not (type->GetFlags() & asOBJ_VALUE)))
+				{
+					continue;
+				}
+
+				for (asUINT i = 0; i < type->GetPropertyCount(); ++i)
+				{
+					int propertyTypeId = 0;
+					int offset = 0;
+					type->GetProperty(i, nullptr, &propertyTypeId, nullptr, nullptr, &offset);
+
+					if (not (propertyTypeId & (asTYPEID_MASK_OBJECT | asTYPEID_OBJHANDLE)))
+					{
+						seed = Scripting::HashBytes((p + offset), static_cast<size_t>(Max(engine->GetSizeOfPrimitiveType(propertyTypeId), 0)), seed);
+					}
+				}
+			}
+		}
+
+		return seed;
+	}
+
+	/// @brief スケジューラの現在の状態のハッシュ値を求める
+	/// @param frame フレーム番号
+	/// @param includeStacks スクリプトのスタック上の変数も含めるか
+	template <class State>
+	Frame Compute(uint64 frame, const CoroutineScheduler<State>& scheduler, bool includeStacks)
+	{
+		Frame result{ .frame = frame };
+		result.coroutines.reserve(scheduler.size());
+
+		const uint64 nanosec = scheduler.clock().nanosec();
+		uint64 hash = Scripting::HashBytes(&nanosec, sizeof(nanosec));
+
+		for (const auto& coro : scheduler.coroutines())
+		{
+			const CoroutineRecord& record = coro->getRecord();
+
+			uint64 coroHash = Scripting::HashState(coro->getState());
+			coroHash = Scripting::HashBytes(&record.wakeTime, sizeof(record.wakeTime), coroHash);
+
+			if (includeStacks)
+			{
+				coroHash = HashStack(coro->getContext(), coroHash);
+			}
+
+			result.coroutines.push_back({ record.id, coroHash });
+
+			const uint64 entry[] = { record.id, coroHash };
+			hash = Scripting::HashBytes(entry, sizeof(entry), hash);
+		}
+
+		result.hash = hash;
+
+		return result;
+	}
+
+	/// @brief フレームごとのハッシュ値をファイルに書き出す
+	class Recorder
+	{
+	public:
+		/// @param seed シミュレーションを始める前に Reseed() した値
+		Recorder(FilePathView path, bool includeStacks, uint64 seed)
+			: writer_{ path }
+			, includeStacks_{ includeStacks }
+		{
+			if (writer_)
+			{
+				writer_.write(Magic);
+				writer_.write(Version);
+				writer_.write(static_cast<uint32>(includeStacks_));
+				writer_.write(seed);
+			}
+		}
+
+		explicit operator bool() const
+		{
+			return static_cast<bool>(writer_);
+		}
+
+		/// @brief 現在の状態のハッシュ値を求めて書き出す
+		template <class State>
+		void record(uint64 frame, const CoroutineScheduler<State>& scheduler)
+		{
+			if (not writer_)
+			{
+				return;
+			}
+
+			const Frame result = Compute(frame, scheduler, includeStacks_);
+
+			writer_.write(result.frame);
+			writer_.write(result.hash);
+			writer_.write(static_cast<uint32>(result.coroutines.size()));
+
+			if (not result.coroutines.isEmpty())
+			{
+				writer_.write(result.coroutines.data(), static_cast<int64>(result.coroutines.size_bytes()));
+			}
+		}
+
+	private:
+		BinaryWriter writer_;
+
+		bool includeStacks_;
+	};
+
+	/// @brief 2つの記録を比べた結果
+	struct Comparison
+	{
+		/// @brief 両方のファイルを読めたか
+		bool ok = false;
+
+		/// @brief 比べたフレーム数
+		uint64 comparedFrames = 0;
+
+		/// @brief 最初に食い違ったフレーム。一致していれば none
+		Optional<uint64> divergedFrame;
+
+		/// @brief 最初に食い違ったコルーチンの id
+		Optional<uint64> divergedCoroutine;
+
+		String message;
+	};
+
+	namespace detail
+	{
+		inline bool ReadFrame(BinaryReader& reader, Frame& frame)
+		{
+			uint32 count = 0;
+
+			if ((not reader.read(frame.frame)) || (not reader.read(frame.hash)) || (not reader.read(count)))
+			{
+				return false;
+			}
+
+			frame.coroutines.resize(count);
+
+			const int64 bytes = static_cast<int64>(frame.coroutines.size_bytes());
+
+			return ((count == 0) || (reader.read(frame.coroutines.data(), bytes) == bytes));
+		}
+
+		inline bool ReadHeader(BinaryReader& reader, uint32& includeStacks, uint64& seed)
+		{
+			uint32 magic = 0, version = 0;
+			return (reader.read(magic) && reader.read(version) && reader.read(includeStacks) && reader.read(seed)
+				&& (magic == Magic) && (version == Version));
+		}
+	}
+
+	/// @brief 2つの記録を先頭から比べ、最初に食い違ったフレームとコルーチンを探す
+	inline Comparison Compare(FilePathView pathA, FilePathView pathB)
+	{
+		Comparison result;
+
+		BinaryReader readerA{ pathA };
+		BinaryReader readerB{ pathB };
+
+		uint32 stacksA = 0, stacksB = 0;
+		uint64 seedA = 0, seedB = 0;
+
+		if ((not readerA) || (not readerB) || (not detail::ReadHeader(readerA, stacksA, seedA)) || (not detail::ReadHeader(readerB, stacksB, seedB)))
+		{
+			result.message = U"failed to read checksum files";
+			return result;
+		}
+
+		result.ok = true;
+
+		if (stacksA != stacksB)
+		{
+			result.message = U"one run includes stacks and the other does not";
+			return result;
+		}
+
+		// 乱数の種が違えば最初のフレームから食い違うので、比べない
+		if (seedA != seedB)
+		{
+			result.message = U"seeds differ (A: {}, B: {}), run both with --seed=N"_fmt(seedA, seedB);
+			return result;
+		}
+
+		Frame a, b;
+
+		for (;;)
+		{
+			const bool hasA = detail::ReadFrame(readerA, a);
+			const bool hasB = detail::ReadFrame(readerB, b);
+
+			if ((not hasA) || (not hasB))
+			{
+				if (hasA != hasB)
+				{
+					result.divergedFrame = (hasA ? a.frame : b.frame);
+					result.message = U"{} ended after {} frames"_fmt((hasA ? U"B" : U"A"), result.comparedFrames);
+				}
+				else
+				{
+					result.message = U"identical ({} frames)"_fmt(result.comparedFrames);
+				}
+
+				return result;
+			}
+
+			if ((a.frame != b.frame) || (a.hash != b.hash))
+			{
+				result.divergedFrame = a.frame;
+				break;
+			}
+
+			++result.comparedFrames;
+		}
+
+		if (a.frame != b.frame)
+		{
+			result.message = U"frame numbers differ (A: {}, B: {})"_fmt(a.frame, b.frame);
+			return result;
+		}
+
+		const size_t count = Min(a.coroutines.size(), b.coroutines.size());
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (a.coroutines[i].id != b.coroutines[i].id)
+			{
+				result.divergedCoroutine = Min(a.coroutines[i].id, b.coroutines[i].id);
+				result.message = U"frame {}: coroutine lists differ at index {} (A: #{}, B: #{})"_fmt(a.frame, i, a.coroutines[i].id, b.coroutines[i].id);
+				return result;
+			}
+
+			if (a.coroutines[i].hash != b.coroutines[i].hash)
+			{
+				result.divergedCoroutine = a.coroutines[i].id;
+				result.message = U"frame {}: coroutine #{} differs"_fmt(a.frame, a.coroutines[i].id);
+				return result;
+			}
+		}
+
+		if (a.coroutines.size() != b.coroutines.size())
+		{
+			result.message = U"frame {}: coroutine counts differ (A: {}, B: {})"_fmt(a.frame, a.coroutines.size(), b.coroutines.size());
+		}
+		else
+		{
+			result.message = U"frame {}: clock differs"_fmt(a.frame);
+		}
+
+		return result;
+	}
+}
@@ -0,0 +1,849 @@
+﻿# pragma once
+# include <Siv3D.hpp>
+# include "CatSimulation.hpp"
+# include "ContextStackSnapshot.hpp"
+
+# if SIV3D_PLATFORM(WINDOWS)
+#	include <Siv3D/Windows/Windows.hpp>
+# elif SIV3D_PLATFORM(LINUX) || SIV3D_PLATFORM(MACOS)
+#	include <fcntl.h>
+#	include <unistd.h>
+# endif
+
+/// @brief ねこシミュレーションをディスクに少しずつ書き出し、異常終了後に復元する
+///
+/// 各ステップで進めた時間と、前のステップから変わったコルーチンのデータ (状態・再開時刻・スタック上の変数) を記録する。
+/// record() を呼んだスレッドでは、全コルーチンのデータのコピー (スタック上の変数の読み取りを含む) だけを行う。
+/// Context はそのスレッドでしか触れないので、このコピーはコルーチンの数とスタックの大きさに比例して毎ステップ掛かる。
+/// 前のステップとの比較・符号化・書き込みは専用の I/O スレッドで行い、溜まった記録をまとめて write してから fdatasync する。
+/// 書き込みか同期に一度でも失敗すると、壊れた記録の後ろに書き足さないように記録をやめる (isOpen() が false になり、error() で理由を得る)。
+///
+/// 中断中のスクリプトの呼び出し履歴は AngelScript の公開APIでは作り直せないので、
+/// 復元は、記録した乱数シードから記録したステップの時間でシミュレーションを進め直して行う。
+/// 進め直した後、コルーチンのデータを最後に記録した値で書き戻す
+/// (中断位置が記録と異なるコルーチンは書き戻せないので diverged に数える)。
+/// 予算 (--sim-budget) やワーカースレッドを使うと進め直しが一致しないことがある。
+///
+/// 進め直しはいつも最初のステップから行うので、途中の全体の記録 (チェックポイント) を置いても復元は短くならない。
+/// そのため全体の記録は書かず、ファイルは切り替えずに伸び続ける。
+/// 復元に掛かる時間は記録したステップ数に比例し、ファイルの大きさは変化したデータの量に比例する。
+/// 読み込みは記録1つずつ行うので、メモリは最後のステップのデータと、ステップごとの時間 (8 バイト) の分だけを使う。
+///
+/// ファイルの形式 (リトルエンディアン):
+///   Header: uint32 magic 'ASJL', uint32 version, uint64 seed, uint32 sizeof(CatState)
+///   Record: uint32 type, uint32 size, uint64 hash (payload の HashBytes), payload[size]
+///   Frame (type 1):      uint64 frame, double deltaSeconds,
+///                        uint32 removedCount, uint64 removedId × removedCount,
+///                        uint32 entryCount, Entry × entryCount
+///     Entry:             uint64 id, uint8 kind (0: 全体, 1: 差分),
+///                        全体: uint32 size, Byte × size / 差分: uint32 runCount, (uint32 offset, uint32 size, Byte × size) × runCount
+/// コルーチンのデータは CatState, uint64 wakeTime, uint8 スタックを保存できたか, スタック上の変数の値 の順。
+/// ハッシュ値が合わないか途中で切れた記録以降は読まない。
+class WorldJournal
+{
+public:
+	static constexpr uint32 Magic = 0x4C4A5341;
+
+	static constexpr uint32 Version = 2;
+
+	/// @brief 書き込み待ちのコルーチンのデータがこれを超えたら、書き込みが追いつくまで record() で待つ
+	static constexpr size_t MaxPendingBytes = (64 << 20);
+
+	/// @param path 書き出すファイル (すでにあれば作り直す)
+	/// @param seed シミュレーションを始める前に Reseed() した値
+	WorldJournal(FilePathView path, uint64 seed)
+	{
+		if (not open_(path))
+		{
+			return;
+		}
+
+		Array<Byte> header;
+		Put_(header, Magic);
+		Put_(header, Version);
+		Put_(header, seed);
+		Put_(header, static_cast<uint32>(sizeof(CatState)));
+
+		thread_ = std::thread{ [this, header = std::move(header)] { ioMain_(header); } };
+	}
+
+	WorldJournal(const WorldJournal&) = delete;
+
+	WorldJournal& operator =(const WorldJournal&) = delete;
+
+	/// @brief 書き込み待ちの記録をすべて書き出してから閉じる
+	~WorldJournal()
+	{
+		if (thread_.joinable())
+		{
+			{
+				std::lock_guard lock{ mutex_ };
+				stop_ = true;
+			}
+
+			wakeCondition_.notify_one();
+			thread_.join();
+		}
+
+		close_();
+	}
+
+	/// @brief 記録中か
+	/// @return 開けなかった場合と、書き込みに失敗して記録をやめた場合は false
+	bool isOpen() const
+	{
+		return (thread_.joinable() && (not failed_));
+	}
+
+	/// @brief 記録をやめた原因の書き込みの失敗
+	/// @return 失敗していなければ none
+	Optional<String> error() const
+	{
+		std::lock_guard lock{ mutex_ };
+		return error_;
+	}
+
+	/// @brief update() した直後に、そのステップを記録する
+	/// @param deltaSeconds update() に渡した時間
+	void record(const CatSimulation& simulation, double deltaSeconds)
+	{
+		if (not isOpen())
+		{
+			return;
+		}
+
+		// ここではコピーだけを行い、前のステップとの比較と符号化は I/O スレッドに任せる
+		Step_ step{ .frame = simulation.stats().steps, .deltaSeconds = deltaSeconds };
+		step.entries.reserve(simulation.scheduler().size());
+
+		size_t bytes = 0;
+
+		for (const auto& coro : simulation.scheduler().coroutines())
+		{
+			step.entries.push_back({ coro->getRecord().id, MakeBytes_(*coro) });
+			bytes += step.entries.back().bytes.size();
+		}
+
+		std::unique_lock lock{ mutex_ };
+
+		if (MaxPendingBytes < pendingBytes_)
+		{
+			++stalls_;
+			spaceCondition_.wait(lock, [this] { return ((pendingBytes_ <= MaxPendingBytes) || failed_); });
+		}
+
+		if (failed_)
+		{
+			return;
+		}
+
+		pendingBytes_ += bytes;
+		pending_.push_back(std::move(step));
+		lock.unlock();
+
+		wakeCondition_.notify_one();
+	}
+
+	/// @brief ディスクへの書き込みと同期を終えた最後のステップ
+	uint64 durableFrame() const
+	{
+		return durableFrame_;
+	}
+
+	/// @brief 書き込みが追いつかず record() で待った回数
+	size_t stalls() const
+	{
+		std::lock_guard lock{ mutex_ };
+		return stalls_;
+	}
+
+	/// @brief 読み込んだ記録
+	class Recording
+	{
+	public:
+		/// @brief 復元の結果
+		struct ReplayResult
+		{
+			/// @brief 進め直したステップ数
+			uint64 frames = 0;
+
+			/// @brief 記録したデータで書き戻したコルーチンの数
+			size_t restored = 0;
+
+			/// @brief 記録と一致させられなかったコルーチンの数
+			size_t diverged = 0;
+		};
+
+		uint64 seed = 0;
+
+		/// @brief 最後に読めたステップ
+		uint64 lastFrame = 0;
+
+		/// @brief 各ステップで進めた時間
+		Array<double> deltaSeconds;
+
+		/// @brief 最後に読めたステップのコルーチンのデータ (id の順)
+		Array<std::pair<uint64, Array<Byte>>> coroutines;
+
+		/// @brief 作成したばかりのシミュレーションを、記録の最後のステップまで進め直す
+		/// @param journal 進め直したステップを新しく記録する場合に指定する
+		ReplayResult replay(CatSimulation& simulation, WorldJournal* journal = nullptr) const
+		{
+			ReplayResult result;
+
+			Reseed(seed);
+
+			for (const double delta : deltaSeconds)
+			{
+				simulation.update(delta);
+				++result.frames;
+
+				if (journal)
+				{
+					journal->record(simulation, delta);
+				}
+			}
+
+			size_t index = 0;
+
+			for (const auto& coro : simulation.scheduler().coroutines())
+			{
+				const uint64 id = coro->getRecord().id;
+
+				while ((index < coroutines.size()) && (coroutines[index].first < id))
+				{
+					++result.diverged;
+					++index;
+				}
+
+				if ((index < coroutines.size()) && (coroutines[index].first == id) && RestoreCoro_(*coro, coroutines[index].second))
+				{
+					++result.restored;
+					++index;
+				}
+				else
+				{
+					++result.diverged;
+				}
+			}
+
+			result.diverged += (coroutines.size() - Min(index, coroutines.size()));
+
+			return result;
+		}
+	};
+
+	/// @brief 記録を読み込む
+	/// @return ヘッダを読めなければ none。途中で壊れていれば、その前までを読む
+	static Optional<Recording> Load(FilePathView path)
+	{
+		BinaryReader reader{ path };
+
+		if (not reader)
+		{
+			return none;
+		}
+
+		uint32 magic = 0, version = 0, stateSize = 0;
+		Recording recording;
+
+		if ((not reader.read(magic)) || (not reader.read(version)) || (not reader.read(recording.seed)) || (not reader.read(stateSize))
+			|| (magic != Magic) || (version != Version) || (stateSize != sizeof(CatState)))
+		{
+			return none;
+		}
+
+		// ファイル全体ではなく、記録1つ分ずつ読む
+		Array<Entry_> current;
+		Array<Byte> record;
+
+		for (;;)
+		{
+			uint32 type = 0, size = 0;
+			uint64 hash = 0;
+
+			if ((not reader.read(type)) || (not reader.read(size)) || (not reader.read(hash))
+				|| ((reader.size() - reader.getPos()) < static_cast<int64>(size)))
+			{
+				break;
+			}
+
+			record.resize(size);
+
+			if ((reader.read(record.data(), static_cast<int64>(size)) != static_cast<int64>(size))
+				|| (Scripting::HashBytes(record.data(), size) != hash)
+				|| (type != static_cast<uint32>(RecordType::Frame)))
+			{
+				break;
+			}
+
+			Reader_ payload{ record.data(), (record.data() + size) };
+
+			uint64 frame = 0;
+			double delta = 0.0;
+
+			if ((not payload.get(frame)) || (not payload.get(delta)) || (not DecodeFrame_(payload, current)))
+			{
+				break;
+			}
+
+			recording.deltaSeconds.push_back(delta);
+			recording.lastFrame = frame;
+		}
+
+		for (auto& entry : current)
+		{
+			recording.coroutines.emplace_back(entry.id, std::move(entry.bytes));
+		}
+
+		return recording;
+	}
+
+private:
+	enum class RecordType : uint32
+	{
+		Frame = 1,
+	};
+
+	enum class EntryKind : uint8
+	{
+		Full = 0,
+
+		Delta = 1,
+	};
+
+	/// @brief 差分を取る単位(バイト)
+	static constexpr size_t DeltaBlockSize = 8;
+
+	struct Entry_
+	{
+		uint64 id = 0;
+
+		Array<Byte> bytes;
+	};
+
+	struct Reader_
+	{
+		const Byte* p;
+
+		const Byte* end;
+
+		size_t remaining() const
+		{
+			return static_cast<size_t>(end - p);
+		}
+
+		template <class Type>
+		bool get(Type& value)
+		{
+			if (remaining() < sizeof(Type))
+			{
+				return false;
+			}
+
+			std::memcpy(&value, p, sizeof(Type));
+			p += sizeof(Type);
+			return true;
+		}
+
+		bool getBytes(size_t size, Byte* out)
+		{
+			if (remaining() < size)
+			{
+				return false;
+			}
+
+			std::memcpy(out, p, size);
+			p += size;
+			return true;
+		}
+	};
+
+	/// @brief record() したステップ。I/O スレッドで符号化する
+	struct Step_
+	{
+		uint64 frame = 0;
+
+		double deltaSeconds = 0.0;
+
+		/// @brief コルーチンのデータ (id の順)
+		Array<Entry_> entries;
+	};
+
+	/// @brief 前のステップのコルーチンのデータ (id の順)
+	/// @remark I/O スレッドだけが使う
+	Array<Entry_> last_;
+
+	std::thread thread_;
+
+	mutable std::mutex mutex_;
+
+	std::condition_variable wakeCondition_;
+
+	std::condition_variable spaceCondition_;
+
+	Array<Step_> pending_;
+
+	/// @brief pending_ のコルーチンのデータの合計(バイト)
+	size_t pendingBytes_ = 0;
+
+	size_t stalls_ = 0;
+
+	bool stop_ = false;
+
+	/// @brief 書き込みに失敗して記録をやめたか
+	std::atomic<bool> failed_ = false;
+
+	Optional<String> error_;
+
+	std::atomic<uint64> durableFrame_ = 0;
+
+# if SIV3D_PLATFORM(WINDOWS)
+
+	HANDLE file_ = INVALID_HANDLE_VALUE;
+
+# elif SIV3D_PLATFORM(LINUX) || SIV3D_PLATFORM(MACOS)
+
+	int fd_ = -1;
+
+# endif
+
+	template <class Type>
+	static void Put_(Array<Byte>& out, const Type& value)
+	{
+		static_assert(std::is_trivially_copyable_v<Type>);
+		const size_t offset = out.size();
+		out.resize(offset + sizeof(Type));
+		std::memcpy(out.data() + offset, &value, sizeof(Type));
+	}
+
+	static void PutBytes_(Array<Byte>& out, const Array<Byte>& bytes)
+	{
+		Put_(out, static_cast<uint32>(bytes.size()));
+		out.insert(out.end(), bytes.begin(), bytes.end());
+	}
+
+	static void PutRecord_(Array<Byte>& out, RecordType type, const Array<Byte>& payload)
+	{
+		Put_(out, static_cast<uint32>(type));
+		Put_(out, static_cast<uint32>(payload.size()));
+		Put_(out, Scripting::HashBytes(payload.data(), payload.size()));
+		out.insert(out.end(), payload.begin(), payload.end());
+	}
+
+	static Array<Byte> MakeBytes_(const CatSimulation::Scheduler::Coro& coro)
+	{
+		ContextStackSnapshot stack;
+		const uint8 stackOk = stack.capture(coro.getContext());
+
+		Array<Byte> bytes;
+		Put_(bytes, coro.getState());
+		Put_(bytes, coro.getWakeTime());
+		Put_(bytes, stackOk);
+
+		if (stackOk)
+		{
+			bytes.insert(bytes.end(), stack.bytes().begin(), stack.bytes().end());
+		}
+
+		return bytes;
+	}
+
+	static bool RestoreCoro_(CatSimulation::Scheduler::Coro& coro, const Array<Byte>& bytes)
+	{
+		constexpr size_t HeaderSize = (sizeof(CatState) + sizeof(uint64) + sizeof(uint8));
+
+		if ((bytes.size() < HeaderSize) || (bytes[HeaderSize - 1] == Byte{ 0 }))
+		{
+			return false;
+		}
+
+		// 進め直した Context で中断位置と変数の並びを取り、値だけを記録のものにする
+		ContextStackSnapshot snapshot;
+
+		if ((not snapshot.capture(coro.getContext())) || (snapshot.bytes().size() != (bytes.size() - HeaderSize)))
+		{
+			return false;
+		}
+
+		snapshot.setBytes(Array<Byte>((bytes.begin() + HeaderSize), bytes.end()));
+
+		if (not snapshot.restore(coro.getContext()))
+		{
+			return false;
+		}
+
+		CatState recorded;
+		uint64 wakeTime;
+		std::memcpy(static_cast<void*>(&recorded), bytes.data(), sizeof(CatState));
+		std::memcpy(&wakeTime, bytes.data() + sizeof(CatState), sizeof(uint64));
+
+		// Stopwatch は記録したプロセスの時計を指しているので、進め直した側のものを使う
+		CatState state = coro.getState();
+		state.pos = recorded.pos;
+		state.sprite = recorded.sprite;
+
+		coro.restore(state, wakeTime);
+
+		return true;
+	}
+
+	/// @brief 前のステップから削除されたコルーチンと、作成・変更されたコルーチンを書く
+	/// @remark 実行リストは id の順のまま削除・末尾に追加されるので、前のステップと先頭から突き合わせる
+	void encodeFrame_(const Array<Entry_>& current, Array<Byte>& out) const
+	{
+		Array<uint64> removed;
+		Array<std::pair<const Entry_*, const Entry_*>> changed;
+
+		size_t j = 0;
+
+		for (const auto& entry : current)
+		{
+			while ((j < last_.size()) && (last_[j].id < entry.id))
+			{
+				removed.push_back(last_[j++].id);
+			}
+
+			const Entry_* base = (((j < last_.size()) && (last_[j].id == entry.id)) ? &last_[j++] : nullptr);
+
+			if ((base == nullptr) || (base->bytes != entry.bytes))
+			{
+				changed.emplace_back(&entry, base);
+			}
+		}
+
+		for (; j < last_.size(); ++j)
+		{
+			removed.push_back(last_[j].id);
+		}
+
+		Put_(out, static_cast<uint32>(removed.size()));
+
+		for (const uint64 id : removed)
+		{
+			Put_(out, id);
+		}
+
+		Put_(out, static_cast<uint32>(changed.size()));
+
+		for (const auto& [entry, base] : changed)
+		{
+			Put_(out, entry->id);
+
+			if ((base == nullptr) || (base->bytes.size() != entry->bytes.size()))
+			{
+				Put_(out, EntryKind::Full);
+				PutBytes_(out, entry->bytes);
+				continue;
+			}
+
+			Put_(out, EntryKind::Delta);
+
+			const size_t countOffset = out.size();
+			Put_(out, uint32{ 0 });
+
+			uint32 runCount = 0;
+			const size_t size = entry->bytes.size();
+
+			for (size_t offset = 0; offset < size;)
+			{
+				if (std::memcmp(base->bytes.data() + offset, entry->bytes.data() + offset, Min(DeltaBlockSize, (size - offset))) == 0)
+				{
+					offset += DeltaBlockSize;
+					continue;
+				}
+
+				// 隣接する変更ブロックをまとめる
+				size_t end = offset;
+
+				while ((end < size) && (std::memcmp(base->bytes.data() + end, entry->bytes.data() + end, Min(DeltaBlockSize, (size - end))) != 0))
+				{
+					end += DeltaBlockSize;
+				}
+
+				end = Min(end, size);
+
+				Put_(out, static_cast<uint32>(offset));
+				Put_(out, static_cast<uint32>(end - offset));
+				out.insert(out.end(), (entry->bytes.begin() + offset), (entry->bytes.begin() + end));
+				++runCount;
+
+				offset = end;
+			}
+
+			std::memcpy(out.data() + countOffset, &runCount, sizeof(runCount));
+		}
+	}
+
+	static bool DecodeFrame_(Reader_& in, Array<Entry_>& current)
+	{
+		uint32 removedCount = 0;
+
+		if (not in.get(removedCount))
+		{
+			return false;
+		}
+
+		HashSet<uint64> removed;
+
+		for (uint32 i = 0; i < removedCount; ++i)
+		{
+			uint64 id = 0;
+
+			if (not in.get(id))
+			{
+				return false;
+			}
+
+			removed.insert(id);
+		}
+
+		current.remove_if([&](const Entry_& entry) { return removed.contains(entry.id); });
+
+		uint32 entryCount = 0;
+
+		if (not in.get(entryCount))
+		{
+			return false;
+		}
+
+		for (uint32 i = 0; i < entryCount; ++i)
+		{
+			uint64 id = 0;
+			EntryKind kind = EntryKind::Full;
+
+			if ((not in.get(id)) || (not in.get(kind)))
+			{
+				return false;
+			}
+
+			// 新しいコルーチンは id が最大なので末尾に、変更は二分探索で見つける
+			auto it = std::lower_bound(current.begin(), current.end(), id, [](const Entry_& entry, uint64 value) { return (entry.id < value); });
+
+			if ((it == current.end()) || (it->id != id))
+			{
+				it = current.insert(it, Entry_{ .id = id });
+			}
+
+			if (kind == EntryKind::Full)
+			{
+				uint32 size = 0;
+
+				if (not in.get(size))
+				{
+					return false;
+				}
+
+				it->bytes.resize(size);
+
+				if (not in.getBytes(size, it->bytes.data()))
+				{
+					return false;
+				}
+
+				continue;
+			}
+
+			uint32 runCount = 0;
+
+			if (not in.get(runCount))
+			{
+				return false;
+			}
+
+			for (uint32 r = 0; r < runCount; ++r)
+			{
+				uint32 offset = 0, size = 0;
+
+				if ((not in.get(offset)) || (not in.get(size)) || (it->bytes.size() < (static_cast<size_t>(offset) + size))
+					|| (not in.getBytes(size, it->bytes.data() + offset)))
+				{
+					return false;
+				}
+			}
+		}
+
+		return true;
+	}
+
+	/// @brief 溜まったステップを符号化してまとめて書き出し、同期する
+	void ioMain_(const Array<Byte>& header)
+	{
+		if (not write_(header))
+		{
+			fail_(U"failed to write the journal header"_s);
+			return;
+		}
+
+		Array<Step_> batch;
+		Array<Byte> payload;
+		Array<Byte> buffer;
+
+		for (;;)
+		{
+			{
+				std::unique_lock lock{ mutex_ };
+				wakeCondition_.wait(lock, [this] { return (stop_ || (not pending_.isEmpty())); });
+
+				if (pending_.isEmpty())
+				{
+					break;
+				}
+
+				batch.swap(pending_);
+				pendingBytes_ = 0;
+			}
+
+			spaceCondition_.notify_one();
+
+			buffer.clear();
+
+			for (auto& step : batch)
+			{
+				payload.clear();
+				Put_(payload, step.frame);
+				Put_(payload, step.deltaSeconds);
+				encodeFrame_(step.entries, payload);
+				PutRecord_(buffer, RecordType::Frame, payload);
+
+				last_ = std::move(step.entries);
+			}
+
+			const uint64 frame = batch.back().frame;
+			batch.clear();
+
+			// 途中まで書けた記録の後ろに書き足すと、読み込みはそこで止まって後ろの記録をすべて失うので、やめる
+			if (not write_(buffer))
+			{
+				fail_(U"failed to write the journal after step {}"_fmt(durableFrame_.load()));
+				return;
+			}
+
+			if (not sync_())
+			{
+				fail_(U"failed to sync the journal after step {}"_fmt(durableFrame_.load()));
+				return;
+			}
+
+			durableFrame_ = frame;
+		}
+	}
+
+	/// @brief 記録をやめ、待っている record() を戻す
+	void fail_(String message)
+	{
+		{
+			std::lock_guard lock{ mutex_ };
+			error_ = std::move(message);
+			failed_ = true;
+			pending_.clear();
+			pendingBytes_ = 0;
+		}
+
+		spaceCondition_.notify_all();
+	}
+
+	bool open_(FilePathView path)
+	{
+	# if SIV3D_PLATFORM(WINDOWS)
+
+		file_ = ::CreateFileW(FilePath{ path }.toWstr().c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		return (file_ != INVALID_HANDLE_VALUE);
+
+	# elif SIV3D_PLATFORM(LINUX) || SIV3D_PLATFORM(MACOS)
+
+		fd_ = ::open(FilePath{ path }.toUTF8().c_str(), (O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC), 0644);
+		return (fd_ != -1);
+
+	# else
+
+		return false;
+
+	# endif
+	}
+
+	bool write_(const Array<Byte>& buffer)
+	{
+		const Byte* p = buffer.data();
+		size_t remaining = buffer.size();
+
+		while (0 < remaining)
+		{
+		# if SIV3D_PLATFORM(WINDOWS)
+
+			DWORD written = 0;
+
+			if (not ::WriteFile(file_, p, static_cast<DWORD>(Min<size_t>(remaining, (1u << 30))), &written, nullptr))
+			{
+				return false;
+			}
+
+		# elif SIV3D_PLATFORM(LINUX) || SIV3D_PLATFORM(MACOS)
+
+			const ssize_t written = ::write(fd_, p, remaining);
+
+			if (written < 0)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+
+				return false;
+			}
+
+		# else
+
+			return false;
+
+		# endif
+
+			p += written;
+			remaining -= static_cast<size_t>(written);
+		}
+
+		return true;
+	}
+
+	bool sync_()
+	{
+	# if SIV3D_PLATFORM(WINDOWS)
+
+		return (::FlushFileBuffers(file_) != 0);
+
+	# elif SIV3D_PLATFORM(LINUX)
+
+		return (::fdatasync(fd_) == 0);
+
+	# elif SIV3D_PLATFORM(MACOS)
+
+		return (::fsync(fd_) == 0);
+
+	# else
+
+		return false;
+
+	# endif
+	}
+
+	void close_()
+	{
+	# if SIV3D_PLATFORM(WINDOWS)
+
+		if (file_ != INVALID_HANDLE_VALUE)
+		{
+			::CloseHandle(file_);
+			file_ = INVALID_HANDLE_VALUE;
+		}
+
+	# elif SIV3D_PLATFORM(LINUX) || SIV3D_PLATFORM(MACOS)
+
+		if (fd_ != -1)
+		{
+			::close(fd_);
+			fd_ = -1;
+		}
+
+	# endif
+	}
+};